@@ -0,0 +1,97 @@
+﻿//
+// Timings for pyptr's hot paths against the plain C API. Build the Release
+// configuration; the numbers are printed to stdout.
+//
+
+#include "py_ptr.h"
+
+using namespace python;
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+static double scale(double value, long long factor, bool negate) {
+    return negate ? -value * factor : value * factor;
+}
+
+// The same function written directly against the C API, as a baseline for
+// the cost of a pyptr callback.
+static PyObject *scale_capi(PyObject *, PyObject *args) {
+    double value;
+    long long factor;
+    int negate;
+    if (!PyArg_ParseTuple(args, "dLp", &value, &factor, &negate)) {
+        return nullptr;
+    }
+    return PyFloat_FromDouble(scale(value, factor, negate != 0));
+}
+
+template<typename TFunction>
+static double ns_per_call(TFunction fn, int iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        fn();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+static void benchmark_callback() {
+    static PyMethodDef capi_def = { "scale", scale_capi, METH_VARARGS, nullptr };
+    py_ptr capi = steal(PyCFunction_New(&capi_def, nullptr));
+    auto wrapped = make_callback(&scale);
+    auto args = make_py_tuple(1.5, 2LL, false);
+
+    const int iterations = 1000000;
+    auto capi_ns = ns_per_call([&] { py_ptr r = steal(PyObject_Call(capi, args, nullptr)); }, iterations);
+    auto pyptr_ns = ns_per_call([&] { py_ptr r = steal(PyObject_Call(wrapped, args, nullptr)); }, iterations);
+    std::cout << "callback: C API " << capi_ns << " ns/call, pyptr " << pyptr_ns << " ns/call" << std::endl;
+}
+
+// The work a kernel does per item in the parallel benchmark
+static double polynomial(double x) {
+    double result = 0;
+    for (int i = 0; i < 64; ++i) {
+        result = result * x + 1.0 / (i + 1);
+    }
+    return result;
+}
+
+static void benchmark_parallel() {
+    std::vector<double> inputs(1000000);
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        inputs[i] = static_cast<double>(i) / inputs.size();
+    }
+    auto values = box(inputs.data(), inputs.size());
+
+    // Each includes unboxing the list; the serial loop and
+    // parallel_transform also box the results
+    const int runs = 5;
+
+    auto serial_ns = ns_per_call([&] {
+        auto unboxed = unbox<double>(values);
+        for (auto& v : unboxed) {
+            v = polynomial(v);
+        }
+        auto r = box(unboxed.data(), unboxed.size());
+    }, runs);
+    auto transform_ns = ns_per_call([&] { auto r = parallel_transform<double>(values, polynomial); }, runs);
+    auto for_ns = ns_per_call([&] { parallel_for<double>(values, [](double v) { volatile double r = polynomial(v); (void)r; }); }, runs);
+    std::cout << "parallel: serial " << serial_ns / 1e6 << " ms, parallel_transform " << transform_ns / 1e6
+        << " ms, parallel_for " << for_ns / 1e6 << " ms over " << inputs.size() << " items" << std::endl;
+}
+
+int main() {
+    interpreter py_interpreter;
+
+    PYPTR_GIL(_g, "benchmark");
+    try {
+        benchmark_callback();
+        benchmark_parallel();
+    } catch (const std::exception& exc) {
+        std::cerr << "benchmark failed: " << exc.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "py_ptr.h"
+
+#include <iterator>
+
+namespace python {
+    // A non-owning view of an object as the wrapper type T. No reference is
+    // taken or released, so the view must not outlive whatever keeps the
+    // object alive (usually the container it was read from). Use own() to
+    // get an owning T. In a free-threaded build, only borrow from containers
+    // that no other thread is modifying.
+    template<typename T>
+    class borrowed {
+        mutable T _value;
+
+        void release() {
+            _value.detach();
+        }
+
+        void assign(PyObject *ptr, unchecked_t) {
+            _value = T(steal(ptr), unchecked);
+        }
+
+        void assign(PyObject *ptr, assert_checked_t) {
+            assert(ptr == nullptr || details::check_ptr<T>::check(ptr));
+            _value = T(steal(ptr), unchecked);
+        }
+
+        // Checked before wrapping, so a mismatch never releases the pointer
+        void assign(PyObject *ptr, checked_t) {
+            if (ptr != nullptr && !details::check_ptr<T>::check(ptr)) {
+                PyObject *unused = nullptr;
+                details::throw_invalid_type(unused, details::check_ptr<T>::expected());
+            }
+            _value = T(steal(ptr), unchecked);
+        }
+
+        void assign(PyObject *ptr) {
+            // throwOnTypeError=false never releases the pointer it is given
+            _value = T(steal(ptr), false);
+#ifdef pyptr_typeCHECK
+            if (ptr != nullptr && !_value) {
+                PyObject *unused = nullptr;
+                details::invalid_type(unused, details::check_ptr<T>::expected());
+            }
+#endif
+        }
+
+    public:
+        typedef T value_type;
+
+        borrowed() { }
+        borrowed(nullptr_t) { }
+
+        explicit borrowed(PyObject *ptr) {
+            assign(ptr);
+        }
+
+        template<typename TPolicy, typename = typename ::std::enable_if<details::is_check_policy<TPolicy>::value>::type>
+        borrowed(PyObject *ptr, TPolicy policy) {
+            assign(ptr, policy);
+        }
+
+        borrowed(const borrowed& other) {
+            assign(other._value);
+        }
+
+        borrowed& operator =(const borrowed& other) {
+            release();
+            assign(other._value);
+            return *this;
+        }
+
+        ~borrowed() {
+            release();
+        }
+
+        T own() const {
+            return T(_value);
+        }
+
+        explicit operator T() const {
+            return own();
+        }
+
+        const T& get() const { return _value; }
+        T *operator ->() const { return &_value; }
+        const T& operator *() const { return _value; }
+
+        operator PyObject *() const {
+            return _value;
+        }
+
+        explicit operator bool() const {
+            return static_cast<PyObject*>(_value) != nullptr;
+        }
+    };
+
+    namespace details {
+        struct list_access {
+            static inline PyObject *get(PyObject *seq, Py_ssize_t i) { return PyList_GET_ITEM(seq, i); }
+            static inline Py_ssize_t size(PyObject *seq) { return PyList_GET_SIZE(seq); }
+        };
+
+        struct tuple_access {
+            static inline PyObject *get(PyObject *seq, Py_ssize_t i) { return PyTuple_GET_ITEM(seq, i); }
+            static inline Py_ssize_t size(PyObject *seq) { return PyTuple_GET_SIZE(seq); }
+        };
+
+        // Walks a list or tuple by index, yielding borrowed views of its
+        // items. The sequence must not be resized while it is being walked.
+        template<typename T, typename TAccess>
+        struct borrowed_iterator {
+            typedef ::std::forward_iterator_tag iterator_category;
+            typedef borrowed<T> value_type;
+            typedef Py_ssize_t difference_type;
+            typedef const borrowed<T> *pointer;
+            typedef borrowed<T> reference;
+
+            PyObject *seq;
+            Py_ssize_t index;
+
+            borrowed_iterator(PyObject *seq, Py_ssize_t index) : seq(seq), index(index) { }
+
+            borrowed<T> operator*() const {
+                return borrowed<T>(TAccess::get(seq, index));
+            }
+
+            borrowed_iterator& operator++() {
+                ++index;
+                return *this;
+            }
+
+            borrowed_iterator operator++(int) {
+                auto result = *this;
+                ++index;
+                return result;
+            }
+
+            bool operator==(const borrowed_iterator& other) const {
+                return index == other.index;
+            }
+
+            bool operator!=(const borrowed_iterator& other) const {
+                return index != other.index;
+            }
+        };
+
+        template<typename T, typename TAccess>
+        struct borrowed_range {
+            PyObject *seq;
+
+            borrowed_range(PyObject *seq) : seq(seq) { }
+
+            borrowed_iterator<T, TAccess> begin() const {
+                return borrowed_iterator<T, TAccess>(seq, 0);
+            }
+
+            borrowed_iterator<T, TAccess> end() const {
+                return borrowed_iterator<T, TAccess>(seq, seq != nullptr ? TAccess::size(seq) : 0);
+            }
+
+            size_t size() const {
+                return seq != nullptr ? static_cast<size_t>(TAccess::size(seq)) : 0;
+            }
+        };
+    }
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "py_ptr.h"
+#include "converters.h"
+
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#ifdef pyptr_HAS_SPAN
+#include <span>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <xmmintrin.h>
+#define PYPTR_PREFETCH(P) _mm_prefetch(reinterpret_cast<const char*>(P), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define PYPTR_PREFETCH(P) __builtin_prefetch(P)
+#else
+#define PYPTR_PREFETCH(P) ((void)0)
+#endif
+
+//
+// Conversion of whole lists and tuples to and from native arrays. Numeric
+// items are checked once for a common exact type and then read straight
+// from the objects; only items that need it go through arg_converter.
+//
+//     std::vector<double> values = unbox<double>(lst);
+//     auto lst2 = box(values.data(), values.size());
+//
+
+namespace python {
+    template<typename T> struct py_list;
+
+    namespace details {
+        // Items are scattered on the heap, so touch those a little ahead of
+        // the one being read
+        static const size_t bulk_prefetch_distance = 8;
+
+        inline bool all_of_type(PyObject *const *items, size_t count, PyTypeObject *type) {
+            for (size_t i = 0; i < count; ++i) {
+                if (i + bulk_prefetch_distance < count) {
+                    PYPTR_PREFETCH(items[i + bulk_prefetch_distance]);
+                }
+                if (Py_TYPE(items[i]) != type) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // The slow path may run Python code that changes a list, so the item
+        // is kept alive and the list is checked again afterwards.
+        template<typename T>
+        typename arg_converter<T>::type convert_item(PyObject *seq, PyObject *const *&items, size_t count, size_t i) {
+            py_ptr item(borrow(items[i]));
+            auto result = arg_converter<T>::convert(item);
+            if (static_cast<size_t>(PySequence_Fast_GET_SIZE(seq)) != count) {
+                PyErr_SetString(PyExc_RuntimeError, "sequence changed size during conversion");
+                throw_pyerr();
+            }
+            items = PySequence_Fast_ITEMS(seq);
+            return result;
+        }
+
+        template<typename T>
+        inline bool fits(long long value) {
+            return ::std::is_signed<T>::value
+                ? value >= static_cast<long long>((::std::numeric_limits<T>::min)()) &&
+                  value <= static_cast<long long>((::std::numeric_limits<T>::max)())
+                : value >= 0 &&
+                  static_cast<unsigned long long>(value) <= static_cast<unsigned long long>((::std::numeric_limits<T>::max)());
+        }
+
+        // Reads an exact int that fits in a machine word without raising.
+        template<typename T>
+        inline bool compact_value(PyObject *item, T& value) {
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 12
+            auto obj = reinterpret_cast<PyLongObject*>(item);
+            if (!PyUnstable_Long_IsCompact(obj)) {
+                return false;
+            }
+            long long v = PyUnstable_Long_CompactValue(obj);
+#else
+            int overflow;
+            long long v = PyLong_AsLongLongAndOverflow(item, &overflow);
+            if (overflow != 0) {
+                return false;
+            }
+#endif
+            if (!fits<T>(v)) {
+                return false;
+            }
+            value = static_cast<T>(v);
+            return true;
+        }
+
+        enum class bulk_kind { generic, integer, floating };
+
+        // Only native numbers are read from the objects directly; wrappers
+        // such as py_int take the generic path and keep the objects.
+        template<typename T>
+        struct bulk_kind_of {
+            static const bulk_kind value =
+                !::std::is_arithmetic<T>::value ? bulk_kind::generic :
+                ::std::is_same<typename pyptr_type<T>::type, py_int>::value ? bulk_kind::integer :
+                ::std::is_same<typename pyptr_type<T>::type, py_float>::value ? bulk_kind::floating :
+                bulk_kind::generic;
+        };
+
+        // Converts the count items of a list or tuple into out[0..count).
+        template<typename T, bulk_kind Kind = bulk_kind_of<T>::value>
+        struct bulk_unboxer {
+            template<typename TOut>
+            static void unbox(PyObject *seq, size_t count, TOut out) {
+                PyObject *const *items = PySequence_Fast_ITEMS(seq);
+                for (size_t i = 0; i < count; ++i) {
+                    out[i] = convert_item<T>(seq, items, count, i);
+                }
+            }
+        };
+
+        template<typename T>
+        struct bulk_unboxer<T, bulk_kind::floating> {
+            template<typename TOut>
+            static void unbox(PyObject *seq, size_t count, TOut out) {
+                PyObject *const *items = PySequence_Fast_ITEMS(seq);
+                if (all_of_type(items, count, &PyFloat_Type)) {
+                    for (size_t i = 0; i < count; ++i) {
+                        out[i] = static_cast<T>(PyFloat_AS_DOUBLE(items[i]));
+                    }
+                    return;
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    if (i + bulk_prefetch_distance < count) {
+                        PYPTR_PREFETCH(items[i + bulk_prefetch_distance]);
+                    }
+                    if (PyFloat_CheckExact(items[i])) {
+                        out[i] = static_cast<T>(PyFloat_AS_DOUBLE(items[i]));
+                    } else {
+                        out[i] = convert_item<T>(seq, items, count, i);
+                    }
+                }
+            }
+        };
+
+        template<typename T>
+        struct bulk_unboxer<T, bulk_kind::integer> {
+            template<typename TOut>
+            static void unbox(PyObject *seq, size_t count, TOut out) {
+                PyObject *const *items = PySequence_Fast_ITEMS(seq);
+                auto exact = all_of_type(items, count, &PyLong_Type);
+                for (size_t i = 0; i < count; ++i) {
+                    if (!exact && i + bulk_prefetch_distance < count) {
+                        PYPTR_PREFETCH(items[i + bulk_prefetch_distance]);
+                    }
+                    T value;
+                    if ((exact || PyLong_CheckExact(items[i])) && compact_value(items[i], value)) {
+                        out[i] = value;
+                    } else {
+                        out[i] = convert_item<T>(seq, items, count, i);
+                    }
+                }
+            }
+        };
+
+        inline PyObject *sequence_fast(PyObject *seq) {
+            auto fast = PySequence_Fast(seq, "expected a list or tuple");
+            if (fast == nullptr) {
+                throw_pyerr();
+            }
+            return fast;
+        }
+
+        // Holds a list or tuple, or a list copied from another iterable,
+        // locked against other threads.
+        class fast_sequence {
+            py_ptr _seq;
+            critical_section _lock;
+
+        public:
+            explicit fast_sequence(PyObject *seq) : _seq(steal(sequence_fast(seq))), _lock(_seq) { }
+
+            operator PyObject *() const {
+                return _seq;
+            }
+
+            size_t size() const {
+                return static_cast<size_t>(PySequence_Fast_GET_SIZE(static_cast<PyObject*>(_seq)));
+            }
+        };
+    }
+
+    // Converts every item of seq into out, which must have the same length.
+    template<typename T>
+    void unbox(PyObject *seq, T *out, size_t count) {
+        details::fast_sequence fast(seq);
+        if (fast.size() != count) {
+            PyErr_Format(PyExc_ValueError, "expected %zu items but the sequence has %zu", count, fast.size());
+            details::throw_pyerr();
+        }
+        details::bulk_unboxer<T>::unbox(fast, count, out);
+    }
+
+    template<typename T>
+    ::std::vector<T> unbox(PyObject *seq) {
+        details::fast_sequence fast(seq);
+        ::std::vector<T> result(fast.size());
+        details::bulk_unboxer<T>::unbox(fast, result.size(), result.begin());
+        return result;
+    }
+
+    // Creates a list from count native values.
+    template<typename T>
+    py_list<typename details::pyptr_type<T>::type> box(const T *items, size_t count) {
+        return py_list<typename details::pyptr_type<T>::type>(items, items + count);
+    }
+
+#ifdef pyptr_HAS_SPAN
+    template<typename T>
+    void unbox(PyObject *seq, ::std::span<T> out) {
+        unbox<T>(seq, out.data(), out.size());
+    }
+
+    template<typename T>
+    py_list<typename details::pyptr_type<T>::type> box(::std::span<const T> items) {
+        return box(items.data(), items.size());
+    }
+#endif
+}
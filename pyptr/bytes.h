@@ -0,0 +1,248 @@
+#pragma once
+
+#include "py_ptr.h"
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifdef pyptr_HAS_STRING_VIEW
+#include <string_view>
+#endif
+#ifdef pyptr_HAS_SPAN
+#include <span>
+#endif
+
+//
+// Binary data. The views returned by py_bytes and py_bytearray refer to the
+// object's own storage, so they are valid while the object is alive and,
+// for bytearray, until it is resized.
+//
+
+namespace python {
+    struct py_bytes;
+    struct py_bytearray;
+
+    PYPTR_SIMPLE_CHECKPTR(py_bytes, PyBytes_Type, PyBytes_Check(ptr));
+    PYPTR_SIMPLE_CHECKPTR(py_bytearray, PyByteArray_Type, PyByteArray_Check(ptr));
+
+#ifdef pyptr_HAS_SPAN
+    namespace details {
+        template<> struct pyptr_type<::std::span<const ::std::byte>> { typedef py_bytes type; };
+        template<> struct pyptr_type<::std::vector<::std::byte>> { typedef py_bytes type; };
+    }
+#endif
+
+    struct py_bytes : public details::py_ptrbase<py_bytes> {
+        PYPTR_CONSTRUCTORS(py_bytes);
+
+        py_bytes(const char *data, size_t size) {
+            ptr = PyBytes_FromStringAndSize(data, static_cast<Py_ssize_t>(size));
+            if (ptr == nullptr) details::throw_pyerr();
+        }
+
+#ifdef pyptr_HAS_STRING_VIEW
+        py_bytes(::std::string_view data) : py_bytes(data.data(), data.size()) { }
+#endif
+
+#ifdef pyptr_HAS_SPAN
+        py_bytes(::std::span<const ::std::byte> data)
+            : py_bytes(reinterpret_cast<const char*>(data.data()), data.size()) { }
+
+        py_bytes(const ::std::vector<::std::byte>& data)
+            : py_bytes(reinterpret_cast<const char*>(data.data()), data.size()) { }
+#endif
+
+        const char *data() const {
+            return PyBytes_AS_STRING(ptr);
+        }
+
+        size_t size() const {
+            return static_cast<size_t>(PyBytes_GET_SIZE(ptr));
+        }
+
+        operator ::std::string() const {
+            return ::std::string(data(), size());
+        }
+
+#ifdef pyptr_HAS_STRING_VIEW
+        ::std::string_view view() const {
+            return ::std::string_view(data(), size());
+        }
+#endif
+
+#ifdef pyptr_HAS_SPAN
+        ::std::span<const ::std::byte> span() const {
+            return { reinterpret_cast<const ::std::byte*>(data()), size() };
+        }
+#endif
+    };
+
+    struct py_bytearray : public details::py_ptrbase<py_bytearray> {
+        PYPTR_CONSTRUCTORS(py_bytearray);
+
+        py_bytearray(const char *data, size_t size) {
+            ptr = PyByteArray_FromStringAndSize(data, static_cast<Py_ssize_t>(size));
+            if (ptr == nullptr) details::throw_pyerr();
+        }
+
+#ifdef pyptr_HAS_STRING_VIEW
+        py_bytearray(::std::string_view data) : py_bytearray(data.data(), data.size()) { }
+#endif
+
+#ifdef pyptr_HAS_SPAN
+        py_bytearray(::std::span<const ::std::byte> data)
+            : py_bytearray(reinterpret_cast<const char*>(data.data()), data.size()) { }
+#endif
+
+        char *data() const {
+            return PyByteArray_AS_STRING(ptr);
+        }
+
+        size_t size() const {
+            return static_cast<size_t>(PyByteArray_GET_SIZE(ptr));
+        }
+
+        // Fails with BufferError while the contents are exported
+        void resize(size_t size) {
+            critical_section lock(ptr);
+            if (PyByteArray_Resize(ptr, static_cast<Py_ssize_t>(size)) != 0) {
+                details::throw_pyerr();
+            }
+        }
+
+        operator ::std::string() const {
+            return ::std::string(data(), size());
+        }
+
+#ifdef pyptr_HAS_STRING_VIEW
+        ::std::string_view view() const {
+            return ::std::string_view(data(), size());
+        }
+#endif
+
+#ifdef pyptr_HAS_SPAN
+        ::std::span<::std::byte> span() const {
+            return { reinterpret_cast<::std::byte*>(data()), size() };
+        }
+#endif
+
+        static inline py_bytearray empty() {
+            return steal(PyByteArray_FromStringAndSize(nullptr, 0));
+        }
+    };
+
+    // Builds a bytes object by writing into it directly. The object grows
+    // geometrically and is trimmed by finish(), so the data is copied once,
+    // from the encoder into the result.
+    //
+    //     bytes_writer w(expected_size);
+    //     w.write(header, header_size);
+    //     auto n = encode(w.prepare(max_body), max_body);
+    //     w.commit(n);
+    //     py_bytes message = w.finish();
+    //
+    class bytes_writer {
+        PyObject *_bytes;
+        size_t _size;
+        // Room returned by the last prepare() that may still be committed
+        size_t _prepared;
+
+        // After finish() or a failed resize there is no object to write to
+        PyObject *bytes() const {
+            if (_bytes == nullptr) {
+                PyErr_SetString(PyExc_ValueError, "bytes_writer is finished or failed to grow");
+                details::throw_pyerr();
+            }
+            return _bytes;
+        }
+
+        size_t capacity() const {
+            return static_cast<size_t>(PyBytes_GET_SIZE(bytes()));
+        }
+
+        // Only the writer holds a reference until finish(), which
+        // _PyBytes_Resize requires. On failure it releases the object.
+        void resize(size_t size) {
+            bytes();
+            if (_PyBytes_Resize(&_bytes, static_cast<Py_ssize_t>(size)) != 0) {
+                _size = _prepared = 0;
+                details::throw_pyerr();
+            }
+        }
+
+    public:
+        // The initial capacity is never zero, since the empty bytes object
+        // is shared and cannot be resized in place
+        explicit bytes_writer(size_t capacity = 256) : _size(0), _prepared(0) {
+            _bytes = PyBytes_FromStringAndSize(nullptr, static_cast<Py_ssize_t>(capacity > 0 ? capacity : 1));
+            if (_bytes == nullptr) details::throw_pyerr();
+        }
+
+        ~bytes_writer() {
+            PYPTR_XDECREF(_bytes);
+        }
+
+        bytes_writer(const bytes_writer&) = delete;
+        bytes_writer& operator =(const bytes_writer&) = delete;
+
+        size_t size() const {
+            return _size;
+        }
+
+        void reserve(size_t capacity) {
+            if (capacity > this->capacity()) {
+                resize(capacity);
+            }
+        }
+
+        // Returns room for at least count more bytes. The pointer is valid
+        // until the next call that may grow the object.
+        char *prepare(size_t count) {
+            if (_size + count > capacity()) {
+                auto grown = capacity() * 2;
+                reserve(grown > _size + count ? grown : _size + count);
+            }
+            _prepared = count;
+            return PyBytes_AS_STRING(_bytes) + _size;
+        }
+
+        // Marks count bytes from the last prepare() as written. No more
+        // than were prepared can be committed, and only once.
+        void commit(size_t count) {
+            bytes();
+            if (count > _prepared) {
+                PyErr_SetString(PyExc_ValueError, "commit() exceeds the room from the last prepare()");
+                details::throw_pyerr();
+            }
+            _size += count;
+            _prepared = 0;
+        }
+
+        void write(const char *data, size_t count) {
+            ::std::memcpy(prepare(count), data, count);
+            commit(count);
+        }
+
+        void write(char value) {
+            *prepare(1) = value;
+            commit(1);
+        }
+
+#ifdef pyptr_HAS_STRING_VIEW
+        void write(::std::string_view data) {
+            write(data.data(), data.size());
+        }
+#endif
+
+        // Returns the bytes written so far. The writer is empty afterwards
+        // and raises ValueError if used again.
+        py_bytes finish() {
+            resize(_size);
+            auto result = _bytes;
+            _bytes = nullptr;
+            _size = _prepared = 0;
+            return steal(result);
+        }
+    };
+}
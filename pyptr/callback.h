@@ -1,167 +1,464 @@
-#pragma once
-
-#include "py_ptr.h"
-#include "py_capsule.h"
-#include "py_object.h"
-#include <functional>
-
-namespace python {
-    namespace details {
-        template<typename TResult, typename TInstance, typename... Ts>
-        struct function_type {
-            typedef typename pyptr_type<TResult>::type return_type;
-            typedef TResult (TInstance::*type)(Ts...);
-            typedef typename make_indices<sizeof...(Ts)>::type arg_indices;
-            typedef typename py_tuple<py_object<TInstance>, Ts...> arg_tuple;
-            
-            static inline return_type call(type func, const arg_tuple& args) {
-                return call_helper(func, args, arg_indices());
-            }
-
-            template<size_t... Indices>
-            static inline return_type call_helper(type func, const arg_tuple& args, indices<Indices...>) {
-                return call_and_rethrow([&]() -> return_type {
-                    auto obj = args.get<0>();
-                    return ((*obj)->*func)(args.get<Indices + 1>()...);
-                });
-            }
-        };
-
-        template<typename TInstance, typename... Ts>
-        struct function_type<void, TInstance, Ts...> {
-            typedef typename py_ptr return_type;
-            typedef void(TInstance::*type)(Ts...);
-            typedef typename make_indices<sizeof...(Ts)>::type arg_indices;
-            typedef typename py_tuple<py_object<TInstance>, Ts...> arg_tuple;
-
-            static inline return_type call(type func, const arg_tuple& args) {
-                return call_helper(func, args, arg_indices());
-            }
-
-            template<size_t... Indices>
-            static inline return_type call_helper(type func, const arg_tuple& args, indices<Indices...>) {
-                return call_and_rethrow([&]() -> return_type {
-                    auto obj = args.get<0>();
-                    ((*obj)->*func)(args.get<Indices + 1>()...);
-                    return borrow(Py_None);
-                });
-            }
-        };
-
-        template<typename TResult, typename... Ts>
-        struct function_type<TResult, void, Ts...> {
-            typedef typename pyptr_type<TResult>::type return_type;
-            typedef TResult(*type)(Ts...);
-            typedef typename make_indices<sizeof...(Ts)>::type arg_indices;
-            typedef typename py_tuple<Ts...> arg_tuple;
-            static inline return_type call(type func, const arg_tuple& args) {
-                return call_helper(func, args, arg_indices());
-            }
-            template<size_t... Indices>
-            static inline return_type call_helper(type func, const arg_tuple& args, indices<Indices...>) {
-                return call_and_rethrow([&]() -> return_type {
-                    return func(args.get<Indices>()...);
-                });
-            }
-        };
-
-        template<typename... Ts>
-        struct function_type<void, void, Ts...> {
-            typedef void return_type;
-            typedef void(*type)(Ts...);
-            typedef typename make_indices<sizeof...(Ts)>::type arg_indices;
-            typedef typename py_tuple<Ts...> arg_tuple;
-            static inline py_ptr call(type func, const arg_tuple& args) {
-                return call_helper(func, args, arg_indices());
-            }
-
-            template<size_t... Indices>
-            static inline py_ptr call_helper(type func, const arg_tuple& args, indices<Indices...>) {
-                return call_and_rethrow([&func, &args]() {
-                    func(args.get<Indices>()...);
-                    return borrow(Py_None);
-                });
-            }
-        };
-
-        template<typename TFunc>
-        auto call_and_rethrow(TFunc fn) -> typename pyptr_type<decltype(fn())>::type {
-            try {
-                return fn();
-            } catch(const ::std::runtime_error& e) {
-                PyErr_SetString(PyExc_RuntimeError, e.what());
-                return nullptr;
-            } catch(const ::std::exception& e) {
-                PyErr_SetString(PyExc_Exception, e.what());
-                return nullptr;
-            }
-        }
-    }
-    
-    template<typename TResult, typename TInstance, typename... Ts>
-    struct py_callback : public details::py_ptrbase<py_callback<TResult, TInstance, Ts...>> {
-        typedef details::function_type<TResult, TInstance, Ts...> Function;
-        PYPTR_CONSTRUCTORS(py_callback);
-
-    private:
-        struct capsule_contents {
-            PyMethodDef md;
-            typename Function::type func;
-        };
-
-        static PyObject *called(PyObject *self, PyObject *args, PyObject *kwargs) {
-            py_capsule<capsule_contents> contents(borrow(self));
-            if (contents == nullptr) {
-                return nullptr;
-            }
-            if (contents->md.ml_meth != reinterpret_cast<PyCFunction>(called)) {
-                PyErr_BadInternalCall();
-                return nullptr;
-            }
-
-            typename Function::arg_tuple argTuple = borrow(args);
-            return details::detach(Function::call(contents->func, argTuple));
-        }
-
-        static PyObject *make_cfunction(typename Function::type func, const char *doc) {
-            if (func == nullptr) {
-                return nullptr;
-            }
-            py_capsule<capsule_contents> caps(new capsule_contents());
-            caps->md.ml_name = nullptr;
-            caps->md.ml_meth = reinterpret_cast<PyCFunction>(called);
-            caps->md.ml_flags = METH_VARARGS;
-            caps->md.ml_doc = doc;
-            caps->func = func;
-
-            return PyCFunction_New(&caps->md, caps);
-        }
-
-    public:
-        py_callback(typename Function::type func)
-            : Base(steal(make_cfunction(func, nullptr))) { }
-    };
-
-    namespace details {
-        template<typename TResult, typename TInstance, typename... Ts>
-        struct check_ptr<py_callback<TResult, TInstance, Ts...>> {
-            static bool check(PyObject *ptr) { return PyCFunction_Check(ptr) != 0; }
-            static const char *expected() { return "C function"; }
-        };
-    }
-
-    template<typename TResult, typename TInstance, typename... Ts>
-    py_callback<TResult, TInstance, Ts...> make_callback(TResult (TInstance::*fn)(Ts...)) {
-        return fn;
-    }
-
-    template<typename TResult, typename... Ts>
-    py_callback<TResult, void, Ts...> make_callback(TResult (*fn)(Ts...)) {
-        return fn;
-    }
-
-    template<typename TResult, typename... Ts>
-    py_callback<TResult, void, Ts...> make_callback(TResult (&fn)(Ts...)) {
-        return &fn;
-    }
-}
\ No newline at end of file
+#pragma once
+
+#include "py_ptr.h"
+#include "py_capsule.h"
+#include "py_object.h"
+#include "converters.h"
+#include "errors.h"
+#include "telemetry.h"
+#include <functional>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 7 && !defined(pyptr_NO_FASTCALL)
+#define pyptr_FASTCALL
+#endif
+
+namespace python {
+    namespace details {
+        template<typename TResult, typename TInstance, typename... Ts>
+        struct function_type {
+            typedef typename pyptr_type<TResult>::type return_type;
+            typedef TResult (TInstance::*type)(Ts...);
+            typedef typename make_indices<sizeof...(Ts)>::type arg_indices;
+            typedef typename py_tuple<py_object<TInstance>, Ts...> arg_tuple;
+            static const size_t arg_count = sizeof...(Ts) + 1;
+            
+            static inline return_type call(type func, const arg_tuple& args) {
+                return call(func, &PyTuple_GET_ITEM(static_cast<PyObject*>(args), 0));
+            }
+
+            static inline return_type call(type func, PyObject *const *args) {
+                return call_helper(func, args, arg_indices());
+            }
+
+            template<size_t... Indices>
+            static inline return_type call_helper(type func, PyObject *const *args, indices<Indices...>) {
+                return call_and_rethrow([&]() -> return_type {
+                    auto obj = arg_converter<py_object<TInstance>>::convert(args[0]);
+                    return ((*obj)->*func)(arg_converter<Ts>::convert(args[Indices + 1])...);
+                });
+            }
+        };
+
+        template<typename TInstance, typename... Ts>
+        struct function_type<void, TInstance, Ts...> {
+            typedef typename py_ptr return_type;
+            typedef void(TInstance::*type)(Ts...);
+            typedef typename make_indices<sizeof...(Ts)>::type arg_indices;
+            typedef typename py_tuple<py_object<TInstance>, Ts...> arg_tuple;
+            static const size_t arg_count = sizeof...(Ts) + 1;
+
+            static inline return_type call(type func, const arg_tuple& args) {
+                return call(func, &PyTuple_GET_ITEM(static_cast<PyObject*>(args), 0));
+            }
+
+            static inline return_type call(type func, PyObject *const *args) {
+                return call_helper(func, args, arg_indices());
+            }
+
+            template<size_t... Indices>
+            static inline return_type call_helper(type func, PyObject *const *args, indices<Indices...>) {
+                return call_and_rethrow([&]() -> return_type {
+                    auto obj = arg_converter<py_object<TInstance>>::convert(args[0]);
+                    ((*obj)->*func)(arg_converter<Ts>::convert(args[Indices + 1])...);
+                    return borrow(Py_None);
+                });
+            }
+        };
+
+        template<typename TResult, typename... Ts>
+        struct function_type<TResult, void, Ts...> {
+            typedef typename pyptr_type<TResult>::type return_type;
+            typedef TResult(*type)(Ts...);
+            typedef typename make_indices<sizeof...(Ts)>::type arg_indices;
+            typedef typename py_tuple<Ts...> arg_tuple;
+            static const size_t arg_count = sizeof...(Ts);
+            static inline return_type call(type func, const arg_tuple& args) {
+                return call(func, &PyTuple_GET_ITEM(static_cast<PyObject*>(args), 0));
+            }
+            static inline return_type call(type func, PyObject *const *args) {
+                return call_helper(func, args, arg_indices());
+            }
+            template<size_t... Indices>
+            static inline return_type call_helper(type func, PyObject *const *args, indices<Indices...>) {
+                return call_and_rethrow([&]() -> return_type {
+                    return func(arg_converter<Ts>::convert(args[Indices])...);
+                });
+            }
+        };
+
+        template<typename... Ts>
+        struct function_type<void, void, Ts...> {
+            typedef void return_type;
+            typedef void(*type)(Ts...);
+            typedef typename make_indices<sizeof...(Ts)>::type arg_indices;
+            typedef typename py_tuple<Ts...> arg_tuple;
+            static const size_t arg_count = sizeof...(Ts);
+            static inline py_ptr call(type func, const arg_tuple& args) {
+                return call(func, &PyTuple_GET_ITEM(static_cast<PyObject*>(args), 0));
+            }
+
+            static inline py_ptr call(type func, PyObject *const *args) {
+                return call_helper(func, args, arg_indices());
+            }
+
+            template<size_t... Indices>
+            static inline py_ptr call_helper(type func, PyObject *const *args, indices<Indices...>) {
+                return call_and_rethrow([&func, args]() {
+                    func(arg_converter<Ts>::convert(args[Indices])...);
+                    return borrow(Py_None);
+                });
+            }
+        };
+
+        template<typename TFunc>
+        auto call_and_rethrow(TFunc fn) -> typename pyptr_type<decltype(fn())>::type {
+            try {
+                return fn();
+            } catch(const ::std::exception& e) {
+                set_pyerr(e);
+                return nullptr;
+            }
+        }
+    }
+    
+    template<typename TResult, typename TInstance, typename... Ts>
+    struct py_callback : public details::py_ptrbase<py_callback<TResult, TInstance, Ts...>> {
+        typedef details::function_type<TResult, TInstance, Ts...> Function;
+        PYPTR_CONSTRUCTORS(py_callback);
+
+    private:
+        struct capsule_contents {
+            PyMethodDef md;
+            typename Function::type func;
+            ::std::string name;
+            // Interned keyword names for the trailing parameters
+            ::std::vector<py_str> kwnames;
+#ifdef pyptr_TELEMETRY
+            telemetry::site site;
+
+            capsule_contents() : site("<callback>") { }
+#endif
+        };
+
+        // The capsule is kept alive by the function object for the whole
+        // call, so it is read without taking a reference.
+        static capsule_contents *read_contents(PyObject *self) {
+#if PY_MAJOR_VERSION == 2 && PY_MINOR_VERSION <= 6
+            return *py_capsule<capsule_contents>(borrow(self));
+#else
+            return reinterpret_cast<capsule_contents*>(
+                PyCapsule_GetPointer(self, typeid(py_capsule<capsule_contents>).name())
+            );
+#endif
+        }
+
+        static capsule_contents *get_contents(PyObject *self, PyCFunction expected) {
+            auto contents = read_contents(self);
+            if (contents != nullptr && contents->md.ml_meth != expected) {
+                PyErr_BadInternalCall();
+                return nullptr;
+            }
+            return contents;
+        }
+
+        static bool check_arg_count(Py_ssize_t nargs) {
+            if (nargs == static_cast<Py_ssize_t>(Function::arg_count)) {
+                return true;
+            }
+            PyErr_Format(PyExc_TypeError, "function takes %zd positional arguments but %zd were given",
+                static_cast<Py_ssize_t>(Function::arg_count), nargs);
+            return false;
+        }
+
+        static PyObject *invoke(capsule_contents *contents, PyObject *const *args) {
+            PYPTR_TRACE_ENTRY("py_callback::invoke");
+#ifdef pyptr_TELEMETRY
+            telemetry::scope timing(contents->site);
+            return timing.check(details::detach(Function::call(contents->func, args)));
+#else
+            return details::detach(Function::call(contents->func, args));
+#endif
+        }
+
+        static const char *keyword_text(PyObject *name) {
+#if PY_MAJOR_VERSION == 3
+            auto text = PyUnicode_AsUTF8(name);
+#elif PY_MAJOR_VERSION == 2
+            auto text = PyString_AsString(name);
+#endif
+            if (text == nullptr) {
+                PyErr_Clear();
+                return "?";
+            }
+            return text;
+        }
+
+        // Keyword matching compares pointers first, which succeeds for the
+        // interned names the compiler emits at call sites.
+        static Py_ssize_t find_keyword(capsule_contents *contents, PyObject *name) {
+            auto& names = contents->kwnames;
+            auto first = static_cast<Py_ssize_t>(Function::arg_count - names.size());
+            for (size_t i = 0; i < names.size(); ++i) {
+                if (static_cast<PyObject*>(names[i]) == name) {
+                    return first + static_cast<Py_ssize_t>(i);
+                }
+            }
+            for (size_t i = 0; i < names.size(); ++i) {
+                int match = PyObject_RichCompareBool(names[i], name, Py_EQ);
+                if (match < 0) {
+                    return -1;
+                } else if (match) {
+                    return first + static_cast<Py_ssize_t>(i);
+                }
+            }
+            if (names.empty()) {
+                PyErr_Format(PyExc_TypeError, "%s() takes no keyword arguments", contents->md.ml_name);
+            } else {
+                PyErr_Format(PyExc_TypeError, "%s() got an unexpected keyword argument '%s'",
+                    contents->md.ml_name, keyword_text(name));
+            }
+            return -1;
+        }
+
+        static bool bind_positional(PyObject **bound, PyObject *const *args, Py_ssize_t nargs) {
+            if (nargs > static_cast<Py_ssize_t>(Function::arg_count)) {
+                return check_arg_count(nargs);
+            }
+            for (size_t i = 0; i < Function::arg_count; ++i) {
+                bound[i] = static_cast<Py_ssize_t>(i) < nargs ? args[i] : nullptr;
+            }
+            return true;
+        }
+
+        static bool bind_keyword(capsule_contents *contents, PyObject **bound, PyObject *name, PyObject *value) {
+            auto index = find_keyword(contents, name);
+            if (index < 0) {
+                return false;
+            } else if (bound[index] != nullptr) {
+                PyErr_Format(PyExc_TypeError, "%s() got multiple values for argument '%s'",
+                    contents->md.ml_name, keyword_text(name));
+                return false;
+            }
+            bound[index] = value;
+            return true;
+        }
+
+        static bool check_bound(capsule_contents *contents, PyObject **bound) {
+            auto first = Function::arg_count - contents->kwnames.size();
+            for (size_t i = 0; i < Function::arg_count; ++i) {
+                if (bound[i] != nullptr) {
+                    continue;
+                } else if (i >= first) {
+                    PyErr_Format(PyExc_TypeError, "%s() missing required argument '%s'",
+                        contents->md.ml_name, keyword_text(contents->kwnames[i - first]));
+                } else {
+                    check_arg_count(static_cast<Py_ssize_t>(i));
+                }
+                return false;
+            }
+            return true;
+        }
+
+        static PyObject *called(PyObject *self, PyObject *args, PyObject *kwargs) {
+            auto contents = get_contents(self, reinterpret_cast<PyCFunction>(called));
+            if (contents == nullptr) {
+                return nullptr;
+            }
+            auto nargs = PyTuple_GET_SIZE(args);
+            if (kwargs == nullptr || PyDict_Size(kwargs) == 0) {
+                if (!check_arg_count(nargs)) {
+                    return nullptr;
+                }
+                return invoke(contents, &PyTuple_GET_ITEM(args, 0));
+            }
+
+            PyObject *bound[Function::arg_count + 1];
+            if (!bind_positional(bound, &PyTuple_GET_ITEM(args, 0), nargs)) {
+                return nullptr;
+            }
+            Py_ssize_t pos = 0;
+            PyObject *key, *value;
+            while (PyDict_Next(kwargs, &pos, &key, &value)) {
+                if (!bind_keyword(contents, bound, key, value)) {
+                    return nullptr;
+                }
+            }
+            if (!check_bound(contents, bound)) {
+                return nullptr;
+            }
+            return invoke(contents, bound);
+        }
+
+#ifdef pyptr_FASTCALL
+        static PyObject *called_fast(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+            auto contents = get_contents(self, reinterpret_cast<PyCFunction>(called_fast));
+            if (contents == nullptr || !check_arg_count(nargs)) {
+                return nullptr;
+            }
+            return invoke(contents, args);
+        }
+
+        static PyObject *called_fast_kw(PyObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames) {
+            auto contents = get_contents(self, reinterpret_cast<PyCFunction>(called_fast_kw));
+            if (contents == nullptr) {
+                return nullptr;
+            }
+            if (kwnames == nullptr || PyTuple_GET_SIZE(kwnames) == 0) {
+                if (!check_arg_count(nargs)) {
+                    return nullptr;
+                }
+                return invoke(contents, args);
+            }
+
+            PyObject *bound[Function::arg_count + 1];
+            if (!bind_positional(bound, args, nargs)) {
+                return nullptr;
+            }
+            for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(kwnames); ++i) {
+                if (!bind_keyword(contents, bound, PyTuple_GET_ITEM(kwnames, i), args[nargs + i])) {
+                    return nullptr;
+                }
+            }
+            if (!check_bound(contents, bound)) {
+                return nullptr;
+            }
+            return invoke(contents, bound);
+        }
+#endif
+
+        static PyCFunction entry_point(int flags) {
+#ifdef pyptr_FASTCALL
+            if (flags == (METH_FASTCALL | METH_KEYWORDS)) {
+                return reinterpret_cast<PyCFunction>(called_fast_kw);
+            } else if (flags == METH_FASTCALL) {
+                return reinterpret_cast<PyCFunction>(called_fast);
+            }
+#endif
+            if (flags != METH_VARARGS && flags != (METH_VARARGS | METH_KEYWORDS)) {
+                throw ::std::invalid_argument("unsupported calling convention");
+            }
+            return reinterpret_cast<PyCFunction>(called);
+        }
+
+        static PyObject *make_cfunction(typename Function::type func, const char *doc, int flags) {
+            if (func == nullptr) {
+                return nullptr;
+            }
+            py_capsule<capsule_contents> caps(new capsule_contents());
+            caps->md.ml_name = "<callback>";
+            caps->md.ml_meth = entry_point(flags);
+            caps->md.ml_flags = flags;
+            caps->md.ml_doc = doc;
+            caps->func = func;
+
+            return PyCFunction_New(&caps->md, caps);
+        }
+
+    public:
+#ifdef pyptr_FASTCALL
+        static const int default_flags = METH_FASTCALL;
+#else
+        static const int default_flags = METH_VARARGS;
+#endif
+
+        py_callback(typename Function::type func)
+            : Base(steal(make_cfunction(func, nullptr, default_flags))) { }
+
+        // flags selects the calling convention: METH_VARARGS, or (when
+        // pyptr_FASTCALL is defined) METH_FASTCALL or METH_FASTCALL | METH_KEYWORDS.
+        py_callback(typename Function::type func, int flags)
+            : Base(steal(make_cfunction(func, nullptr, flags))) { }
+
+        // names lets the trailing parameters be passed by keyword. For
+        // member functions the instance is always positional.
+        py_callback(typename Function::type func, ::std::initializer_list<const char*> names)
+            : Base(steal(make_cfunction(func, nullptr, default_flags | METH_KEYWORDS))) {
+            set_keywords(names);
+        }
+
+        void set_keywords(::std::initializer_list<const char*> names) {
+            // Not Function::arg_count, which includes the instance
+            if (names.size() > sizeof...(Ts)) {
+                throw ::std::invalid_argument("more keyword names than parameters");
+            }
+            auto contents = read_contents(PyCFunction_GET_SELF(this->ptr));
+            if (contents == nullptr) details::throw_pyerr();
+            contents->kwnames.clear();
+            for (auto name : names) {
+#if PY_MAJOR_VERSION == 3
+                contents->kwnames.push_back(steal(PyUnicode_InternFromString(name)));
+#elif PY_MAJOR_VERSION == 2
+                contents->kwnames.push_back(steal(PyString_InternFromString(name)));
+#endif
+            }
+        }
+
+        // Sets the __name__ of the function object, which is also the name
+        // its telemetry is recorded under.
+        void set_name(const char *name) {
+            auto contents = read_contents(PyCFunction_GET_SELF(this->ptr));
+            if (contents == nullptr) details::throw_pyerr();
+            contents->name = name;
+            contents->md.ml_name = contents->name.c_str();
+#ifdef pyptr_TELEMETRY
+            contents->site.rename(contents->name);
+#endif
+        }
+    };
+
+    namespace details {
+        template<typename TResult, typename TInstance, typename... Ts>
+        struct check_ptr<py_callback<TResult, TInstance, Ts...>> {
+            static bool check(PyObject *ptr) { return PyCFunction_Check(ptr) != 0; }
+            static const char *expected() { return "C function"; }
+        };
+    }
+
+    template<typename TResult, typename TInstance, typename... Ts>
+    py_callback<TResult, TInstance, Ts...> make_callback(TResult (TInstance::*fn)(Ts...)) {
+        return fn;
+    }
+
+    template<typename TResult, typename... Ts>
+    py_callback<TResult, void, Ts...> make_callback(TResult (*fn)(Ts...)) {
+        return fn;
+    }
+
+    template<typename TResult, typename... Ts>
+    py_callback<TResult, void, Ts...> make_callback(TResult (&fn)(Ts...)) {
+        return &fn;
+    }
+
+    template<typename TResult, typename TInstance, typename... Ts>
+    py_callback<TResult, TInstance, Ts...> make_callback(TResult (TInstance::*fn)(Ts...), int flags) {
+        return py_callback<TResult, TInstance, Ts...>(fn, flags);
+    }
+
+    template<typename TResult, typename... Ts>
+    py_callback<TResult, void, Ts...> make_callback(TResult (*fn)(Ts...), int flags) {
+        return py_callback<TResult, void, Ts...>(fn, flags);
+    }
+
+    template<typename TResult, typename TInstance, typename... Ts>
+    py_callback<TResult, TInstance, Ts...> make_callback(TResult (TInstance::*fn)(Ts...), ::std::initializer_list<const char*> names) {
+        return py_callback<TResult, TInstance, Ts...>(fn, names);
+    }
+
+    template<typename TResult, typename... Ts>
+    py_callback<TResult, void, Ts...> make_callback(TResult (*fn)(Ts...), ::std::initializer_list<const char*> names) {
+        return py_callback<TResult, void, Ts...>(fn, names);
+    }
+
+    namespace details {
+        template<typename TFunction>
+        auto make_named_callback(TFunction fn, const char *name) -> decltype(make_callback(fn)) {
+            auto callback = make_callback(fn);
+            callback.set_name(name);
+            return callback;
+        }
+    }
+}
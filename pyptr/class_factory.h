@@ -1,432 +1,758 @@
-#pragma once
-
-#include "py_ptr.h"
-#include "initialization.h"
-#include "strings.h"
-#include "dict.h"
-
-#include "py_type.h"
-#include "py_object.h"
-
-#include <array>
-
-namespace python {
-    namespace details {
-        struct method_descriptor_maker {
-            struct data {
-                PyObject_HEAD;
-                PyObject *name;
-                PyObject *function;
-            };
-
-            struct getset_maker {
-                struct holder {
-                    PyGetSetDef *data;
-                    operator PyGetSetDef *() { return data; }
-                    holder(size_t count) : data(new PyGetSetDef[count]) { }
-                    ~holder() { delete[] data; }
-                };
-
-                static inline PyObject *get_func(data *obj, void*) {
-                    Py_XINCREF(obj->function);
-                    return obj->function;
-                }
-
-                static inline PyObject *get_name(data *obj, void*) {
-                    Py_XINCREF(obj->name);
-                    return obj->name;
-                }
-
-                inline py_capsule<holder> operator()() {
-                    py_capsule<holder> caps(new holder(4));
-                    PyGetSetDef *defs = **caps;
-                    memset(defs, 0, sizeof(PyGetSetDef) * 4);
-                    defs[0].name = "im_func";
-                    defs[0].get = reinterpret_cast<getter>(get_func);
-                    defs[1].name = "__func__";
-                    defs[1].get = reinterpret_cast<getter>(get_func);
-                    defs[2].name = "__name__";
-                    defs[2].get = reinterpret_cast<getter>(get_name);
-
-                    return caps;
-                }
-            };
-
-            inline static int init(PyObject *self, PyObject *args, PyObject*) {
-                PyObject *name, *function;
-                if (!PyArg_UnpackTuple(args, Py_TYPE(self)->tp_name, 2, 2, &name, &function)) return -1;
-
-                auto ptr = reinterpret_cast<data*>(self);
-                Py_XDECREF(ptr->name);
-                Py_XINCREF(name);
-                ptr->name = name;
-                Py_XDECREF(ptr->function);
-                Py_XINCREF(function);
-                ptr->function = function;
-                return 0;
-            }
-
-            inline static void dealloc(PyObject *self) {
-                auto ptr = reinterpret_cast<data*>(self);
-                Py_CLEAR(ptr->name);
-                Py_CLEAR(ptr->function);
-            }
-
-            inline static PyTypeObject *begin_type(const char *name) {
-                gil _gil;
-                auto type = reinterpret_cast<PyHeapTypeObject*>(PyType_GenericAlloc(&PyType_Type, 0));
-                if (type == nullptr) {
-                    throw_pyerr();
-                    return nullptr;
-                }
-                type->ht_type.tp_name = name;
-                type->ht_type.tp_basicsize = sizeof(data);
-                type->ht_type.tp_alloc = PyType_GenericAlloc;
-                type->ht_type.tp_init = init;
-                type->ht_type.tp_dealloc = dealloc;
-                type->ht_type.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HEAPTYPE;
-                auto lastNamePart = strrchr(name, '.');
-                if (!lastNamePart) {
-                    lastNamePart = name;
-                }
-                py_str nameobj(lastNamePart);
-                type->ht_name = static_cast<PyObject*>(borrow(nameobj));
-#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 3
-                type->ht_qualname = static_cast<PyObject*>(borrow(nameobj));
-#endif
-
-                auto getsets = _gil.current_interpreter().get_or_make_static_ptr<getset_maker>();
-                type->ht_type.tp_getset = **getsets;
-
-                return reinterpret_cast<PyTypeObject*>(type);
-            }
-
-            inline static py_type<py_ptr> end_type(PyTypeObject *type) {
-                if (type == nullptr || PyType_Ready(type) < 0) {
-                    Py_XDECREF(type);
-                    throw_pyerr();
-                    return nullptr;
-                }
-                return steal(reinterpret_cast<PyObject*>(type));
-            }
-        };
-
-        struct instance_method_descriptor_maker : method_descriptor_maker {
-            inline static PyObject *descr_get(PyObject *self, PyObject *obj, PyObject *type) {
-                auto ptr = reinterpret_cast<data*>(self);
-#if PY_MAJOR_VERSION == 3
-                if (obj == nullptr) {
-                    return self;
-                } else {
-                    return PyMethod_New(ptr->function, obj);
-                }
-#elif PY_MAJOR_VERSION == 2
-                return PyMethod_New(ptr->function, obj, type);
-#endif
-            }
-
-            inline py_type<py_ptr> operator()() {
-                auto type = begin_type("pyptr.instance_method");
-                if (type != nullptr) {
-                    type->tp_descr_get = descr_get;
-                }
-                return end_type(type);
-            }
-        };
-
-        struct class_method_descriptor_maker : method_descriptor_maker {
-            inline static PyObject *descr_get(PyObject *self, PyObject *obj, PyObject *type) {
-                auto ptr = reinterpret_cast<data*>(self);
-#if PY_MAJOR_VERSION == 3
-                if (type == nullptr) {
-                    return self;
-                } else {
-                    return PyMethod_New(ptr->function, type);
-                }
-#elif PY_MAJOR_VERSION == 2
-                if (type == nullptr) {
-                    return self;
-                } else {
-                    return PyMethod_New(ptr->function, type, reinterpret_cast<PyObject*>(Py_TYPE(type)));
-                }
-#endif
-            }
-
-            inline py_type<py_ptr> operator()() {
-                auto type = begin_type("pyptr.class_method");
-                if (type != nullptr) {
-                    type->tp_descr_get = descr_get;
-                }
-                return end_type(type);
-            }
-        };
-
-        struct property_descriptor_maker {
-            struct data {
-                PyObject_HEAD;
-                PyObject *name;
-                PyObject *getter;
-                PyObject *setter;
-            };
-
-            inline static int init(PyObject *self, PyObject *args, PyObject*) {
-                PyObject *name, *getter, *setter = nullptr;
-                if (!PyArg_UnpackTuple(args, Py_TYPE(self)->tp_name, 2, 3, &name, &getter, &setter)) return -1;
-
-                auto ptr = reinterpret_cast<data*>(self);
-                Py_XDECREF(ptr->name);
-                Py_XINCREF(name);
-                ptr->name = name;
-                Py_XDECREF(ptr->getter);
-                Py_XINCREF(getter);
-                ptr->getter = getter;
-                Py_XDECREF(ptr->setter);
-                Py_XINCREF(setter);
-                ptr->setter = setter;
-                return 0;
-            }
-
-            inline static void dealloc(PyObject *self) {
-                auto ptr = reinterpret_cast<data*>(self);
-                Py_CLEAR(ptr->name);
-                Py_CLEAR(ptr->getter);
-                Py_CLEAR(ptr->setter);
-            }
-
-            inline static PyObject *get(PyObject *self, PyObject *obj, PyObject *type) {
-                if (self == nullptr || obj == nullptr) {
-                    Py_XINCREF(self);
-                    return self;
-                }
-                auto ptr = reinterpret_cast<data*>(self);
-                return PyObject_CallFunctionObjArgs(ptr->getter, obj, nullptr);
-            }
-
-            inline static int set(PyObject *self, PyObject *obj, PyObject *value) {
-                if (self == nullptr || obj == nullptr || value == nullptr) {
-                    return -1;
-                }
-                auto ptr = reinterpret_cast<data*>(self);
-                if (ptr->setter == nullptr) {
-                    PyErr_SetString(PyExc_AttributeError, "can't set attribute");
-                    return -1;
-                }
-                auto res = PyObject_CallFunctionObjArgs(ptr->setter, obj, value, nullptr);
-                if (res == nullptr) {
-                    return -1;
-                }
-                Py_DECREF(res);
-                return 0;
-            }
-
-            inline py_type<py_ptr> operator()() {
-                gil _gil;
-                auto type = reinterpret_cast<PyHeapTypeObject*>(PyType_GenericAlloc(&PyType_Type, 0));
-                if (type == nullptr) {
-                    throw_pyerr();
-                    return nullptr;
-                }
-                type->ht_type.tp_name = "pyptr.property";
-                type->ht_type.tp_basicsize = sizeof(data);
-                type->ht_type.tp_alloc = PyType_GenericAlloc;
-                type->ht_type.tp_init = init;
-                type->ht_type.tp_dealloc = dealloc;
-                type->ht_type.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HEAPTYPE;
-                type->ht_type.tp_descr_get = get;
-                type->ht_type.tp_descr_set = set;
-                auto lastNamePart = strrchr(type->ht_type.tp_name, '.');
-                if (!lastNamePart) {
-                    lastNamePart = type->ht_type.tp_name;
-                }
-                py_str nameobj(lastNamePart);
-                type->ht_name = static_cast<PyObject*>(borrow(nameobj));
-#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 3
-                type->ht_qualname = static_cast<PyObject*>(borrow(nameobj));
-#endif
-
-                if (type == nullptr || PyType_Ready(&type->ht_type) < 0) {
-                    Py_XDECREF(type);
-                    throw_pyerr();
-                    return nullptr;
-                }
-                return steal(reinterpret_cast<PyObject*>(type));
-            }
-        };
-
-        template <typename TGetter, typename TSetter>
-        struct property_proxy {
-            TGetter get;
-            TSetter set;
-
-            property_proxy(TGetter get, TSetter set)
-                : get(get), set(set) { }
-        };
-
-        template<typename TInner>
-        class class_member_proxy {
-            typedef typename class_factory<TInner>::Type Type;
-            typedef typename class_factory<TInner>::Instance Instance;
-
-            class_factory<TInner>& owner;
-            const char *name;
-
-        public:
-            class_member_proxy(const char *name, class_factory<TInner>& owner)
-                : name(name), owner(owner) { }
-
-            // Add data member
-            class_member_proxy<TInner>& operator =(const py_ptr& value) {
-                owner._members[name] = value;
-                return *this;
-            }
-
-            // Add instance method
-            template<typename TResult, typename... Ts>
-            class_member_proxy<TInner>& operator =(TResult (*value)(Instance, Ts...)) {
-                gil _gil;
-                auto descr = _gil.current_interpreter().get_or_make_static_ptr<details::instance_method_descriptor_maker>();
-                owner._members[name] = python::call(descr, py_str(name), make_callback(value));
-                return *this;
-            }
-
-            // Add implicit instance method
-            template<typename TResult, typename... Ts>
-            class_member_proxy<TInner>& operator =(TResult (TInner::*value)(Ts...)) {
-                gil _gil;
-                auto descr = _gil.current_interpreter().get_or_make_static_ptr<details::instance_method_descriptor_maker>();
-                owner._members[name] = python::call(descr, py_str(name), make_callback(value));
-                return *this;
-            }
-
-            // Add class method
-            template<typename TResult, typename... Ts>
-            class_member_proxy<TInner>& operator =(TResult(*value)(Type, Ts...)) {
-                gil _gil;
-                auto descr = _gil.current_interpreter().get_or_make_static_ptr<details::class_method_descriptor_maker>();
-                owner._members[name] = python::call(descr, py_str(name), make_callback(value));
-                return *this;
-            }
-
-            // Add static method
-            template<typename TResult, typename... Ts>
-            class_member_proxy<TInner>& operator =(const py_callback<TResult, void, Ts...>& value) {
-                owner._members[name] = value;
-                return *this;
-            }
-
-            template<typename TFunction>
-            class_member_proxy<TInner>& operator =(TFunction *fn) {
-                return operator =(make_callback(fn));
-            }
-
-            template<typename TGetter, typename TSetter>
-            class_member_proxy<TInner>& operator =(const property_proxy<TGetter, TSetter>& value) {
-                gil _gil;
-                auto descr = _gil.current_interpreter().get_or_make_static_ptr<details::property_descriptor_maker>();
-                owner._members[name] = python::call(descr, py_str(name), value.get, value.set);
-                return *this;
-            }
-
-            template<typename TGetter>
-            class_member_proxy<TInner>& operator =(const property_proxy<TGetter, nullptr_t>& value) {
-                gil _gil;
-                auto descr = _gil.current_interpreter().get_or_make_static_ptr<details::property_descriptor_maker>();
-                owner._members[name] = python::call(descr, py_str(name), value.get);
-                return *this;
-            }
-        };
-    }
-
-    template<typename TResult, typename... Ts>
-    py_ptr static_method(const py_callback<TResult, void, Ts...>& value) {
-        return value;
-    }
-
-    template<typename TFunction>
-    py_ptr static_method(TFunction *fn) {
-        return static_method(make_callback(fn));
-    }
-
-    template<typename TSelf, typename TResult1, typename TResult2>
-    details::property_proxy<py_callback<TResult1,void,py_object<TSelf>>, py_callback<void,void,py_object<TSelf>,TResult1>>
-    property(TResult1 (*get)(py_object<TSelf>), void (*set)(py_object<TSelf>, TResult2)) {
-        static_assert(::std::is_same<TResult1, TResult2>::value, "getter and setter must have same value type");
-        return{ get, set };
-    }
-
-    template<typename TSelf, typename TResult1, typename TResult2>
-    details::property_proxy<py_callback<TResult1,TSelf>, py_callback<void,TSelf,TResult1>>
-    property(TResult1(TSelf::*get)(), void(TSelf::*set)(TResult2)) {
-        static_assert(::std::is_same<TResult1, TResult2>::value, "getter and setter must have same value type");
-        return{ get, set };
-    }
-
-    template<typename TSelf, typename TResult>
-    details::property_proxy<py_callback<TResult,void,py_object<TSelf>>, nullptr_t>
-    property(TResult (*get)(py_object<TSelf>)) {
-        return{ get, nullptr };
-    }
-
-    template<typename TSelf, typename TResult>
-    details::property_proxy<py_callback<TResult, TSelf>, nullptr_t>
-    property(TResult(TSelf::*get)()) {
-        return{ get, nullptr };
-    }
-
-    template<typename TInner>
-    class class_factory {
-        friend details::class_member_proxy<TInner>;
-    public:
-        typedef py_object<TInner> Instance;
-        typedef py_type<TInner> Type;
-
-    private:
-        Type _type;
-        py_str _name;
-        py_dict<py_str, py_ptr> _members;
-
-        static int init(PyObject *self, PyObject *args, PyObject *kwargs) {
-            py_object<TInner> obj(borrow(self), new TInner());
-            auto initObj = getattr(obj, "__pyptr_init__", (py_callable<py_ptr>)nullptr);
-            if (initObj) {
-                py_ptr res(steal(PyObject_Call(initObj, args, kwargs)));
-                return res ? 0 : 1;
-            }
-            return 0;
-        }
-
-        inline void construct_type() {
-            if (_type) {
-                return;
-            }
-
-            auto nameParts = _name.rpartition(".");
-            _members.setdefault("__module__", nameParts.get<0>());
-            auto initObj = _members.get("__init__");
-            if (initObj) {
-                _members["__pyptr_init__"] = initObj;
-                _members.del("__init__");
-            }
-            _type = Type(nameParts.get<2>(), ::std::move(_members));
-            auto tp = reinterpret_cast<PyTypeObject*>(static_cast<PyObject*>(_type));
-            tp->tp_init = init;
-            _name = nullptr;
-            _members = nullptr;
-        }
-    public:
-        explicit class_factory(py_str name) : _name(name), _members(py_dict<py_str, py_ptr>::empty()) { }
-
-        inline Type get_type() {
-            construct_type();
-            return _type;
-        }
-
-        inline Instance create_instance() {
-            return call(get_type());
-        }
-
-        inline details::class_member_proxy<TInner> operator[](const char *name) {
-            return details::class_member_proxy<TInner>(name, *this);
-        }
-    };
-}
+#pragma once
+
+#include "py_ptr.h"
+#include "initialization.h"
+#include "strings.h"
+#include "interned.h"
+#include "dict.h"
+#include "errors.h"
+#include "py_buffer.h"
+
+#include "py_type.h"
+#include "py_object.h"
+#include "callable.h"
+#include "overloads.h"
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+
+namespace python {
+    namespace details {
+        struct method_descriptor_maker {
+            struct data {
+                PyObject_HEAD;
+                PyObject *name;
+                PyObject *function;
+#ifdef pyptr_VECTORCALL
+                vectorcallfunc vectorcall;
+#endif
+            };
+
+            struct getset_maker {
+                struct holder {
+                    PyGetSetDef *data;
+                    operator PyGetSetDef *() { return data; }
+                    holder(size_t count) : data(new PyGetSetDef[count]) { }
+                    ~holder() { delete[] data; }
+                };
+
+                static inline PyObject *get_func(data *obj, void*) {
+                    PYPTR_XINCREF(obj->function);
+                    return obj->function;
+                }
+
+                static inline PyObject *get_name(data *obj, void*) {
+                    PYPTR_XINCREF(obj->name);
+                    return obj->name;
+                }
+
+                inline py_capsule<holder> operator()() {
+                    py_capsule<holder> caps(new holder(4));
+                    PyGetSetDef *defs = **caps;
+                    memset(defs, 0, sizeof(PyGetSetDef) * 4);
+                    defs[0].name = "im_func";
+                    defs[0].get = reinterpret_cast<getter>(get_func);
+                    defs[1].name = "__func__";
+                    defs[1].get = reinterpret_cast<getter>(get_func);
+                    defs[2].name = "__name__";
+                    defs[2].get = reinterpret_cast<getter>(get_name);
+
+                    return caps;
+                }
+            };
+
+            inline static int init(PyObject *self, PyObject *args, PyObject*) {
+                PyObject *name, *function;
+                if (!PyArg_UnpackTuple(args, Py_TYPE(self)->tp_name, 2, 2, &name, &function)) return -1;
+
+                auto ptr = reinterpret_cast<data*>(self);
+                PYPTR_XDECREF(ptr->name);
+                PYPTR_XINCREF(name);
+                ptr->name = name;
+                PYPTR_XDECREF(ptr->function);
+                PYPTR_XINCREF(function);
+                ptr->function = function;
+#ifdef pyptr_VECTORCALL
+                ptr->vectorcall = call_function;
+#endif
+                return 0;
+            }
+
+#ifdef pyptr_VECTORCALL
+            // Calling the descriptor calls the function with the same
+            // arguments. With Py_TPFLAGS_METHOD_DESCRIPTOR set this is how
+            // obj.method(...) arrives, with obj already in args[0].
+            inline static PyObject *call_function(PyObject *self, PyObject *const *args, size_t nargsf, PyObject *kwnames) {
+                return PyObject_Vectorcall(reinterpret_cast<data*>(self)->function, args, nargsf, kwnames);
+            }
+#endif
+
+            inline static void dealloc(PyObject *self) {
+                auto ptr = reinterpret_cast<data*>(self);
+                PYPTR_CLEAR(ptr->name);
+                PYPTR_CLEAR(ptr->function);
+            }
+
+            inline static PyTypeObject *begin_type(const char *name) {
+                gil _gil;
+                auto type = reinterpret_cast<PyHeapTypeObject*>(PyType_GenericAlloc(&PyType_Type, 0));
+                if (type == nullptr) {
+                    throw_pyerr();
+                    return nullptr;
+                }
+                type->ht_type.tp_name = name;
+                type->ht_type.tp_basicsize = sizeof(data);
+                type->ht_type.tp_alloc = PyType_GenericAlloc;
+                type->ht_type.tp_init = init;
+                type->ht_type.tp_dealloc = dealloc;
+                type->ht_type.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HEAPTYPE;
+                auto lastNamePart = strrchr(name, '.');
+                if (!lastNamePart) {
+                    lastNamePart = name;
+                }
+                py_str nameobj(lastNamePart);
+                type->ht_name = static_cast<PyObject*>(borrow(nameobj));
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 3
+                type->ht_qualname = static_cast<PyObject*>(borrow(nameobj));
+#endif
+
+                auto getsets = _gil.current_interpreter().get_or_make_static_ptr<getset_maker>();
+                type->ht_type.tp_getset = **getsets;
+
+                return reinterpret_cast<PyTypeObject*>(type);
+            }
+
+            inline static py_type<py_ptr> end_type(PyTypeObject *type) {
+                if (type == nullptr || PyType_Ready(type) < 0) {
+                    PYPTR_XDECREF(type);
+                    throw_pyerr();
+                    return nullptr;
+                }
+                return steal(reinterpret_cast<PyObject*>(type));
+            }
+        };
+
+        struct instance_method_descriptor_maker : method_descriptor_maker {
+            inline static PyObject *descr_get(PyObject *self, PyObject *obj, PyObject *type) {
+                auto ptr = reinterpret_cast<data*>(self);
+#if PY_MAJOR_VERSION == 3
+                if (obj == nullptr) {
+                    PYPTR_INCREF(self);
+                    return self;
+                } else {
+                    return PyMethod_New(ptr->function, obj);
+                }
+#elif PY_MAJOR_VERSION == 2
+                return PyMethod_New(ptr->function, obj, type);
+#endif
+            }
+
+            inline py_type<py_ptr> operator()() {
+                auto type = begin_type("pyptr.instance_method");
+                if (type != nullptr) {
+                    type->tp_descr_get = descr_get;
+#ifdef pyptr_VECTORCALL
+                    // Lets the interpreter call the descriptor with self as
+                    // the first argument instead of binding a method object.
+                    type->tp_flags |= Py_TPFLAGS_METHOD_DESCRIPTOR | Py_TPFLAGS_HAVE_VECTORCALL;
+                    type->tp_vectorcall_offset = offsetof(data, vectorcall);
+                    type->tp_call = PyVectorcall_Call;
+#endif
+                }
+                return end_type(type);
+            }
+        };
+
+        struct class_method_descriptor_maker : method_descriptor_maker {
+            inline static PyObject *descr_get(PyObject *self, PyObject *obj, PyObject *type) {
+                auto ptr = reinterpret_cast<data*>(self);
+#if PY_MAJOR_VERSION == 3
+                if (type == nullptr) {
+                    PYPTR_INCREF(self);
+                    return self;
+                } else {
+                    return PyMethod_New(ptr->function, type);
+                }
+#elif PY_MAJOR_VERSION == 2
+                if (type == nullptr) {
+                    return self;
+                } else {
+                    return PyMethod_New(ptr->function, type, reinterpret_cast<PyObject*>(Py_TYPE(type)));
+                }
+#endif
+            }
+
+            inline py_type<py_ptr> operator()() {
+                auto type = begin_type("pyptr.class_method");
+                if (type != nullptr) {
+                    type->tp_descr_get = descr_get;
+                }
+                return end_type(type);
+            }
+        };
+
+        struct property_descriptor_maker {
+            struct data {
+                PyObject_HEAD;
+                PyObject *name;
+                PyObject *getter;
+                PyObject *setter;
+            };
+
+            inline static int init(PyObject *self, PyObject *args, PyObject*) {
+                PyObject *name, *getter, *setter = nullptr;
+                if (!PyArg_UnpackTuple(args, Py_TYPE(self)->tp_name, 2, 3, &name, &getter, &setter)) return -1;
+
+                auto ptr = reinterpret_cast<data*>(self);
+                PYPTR_XDECREF(ptr->name);
+                PYPTR_XINCREF(name);
+                ptr->name = name;
+                PYPTR_XDECREF(ptr->getter);
+                PYPTR_XINCREF(getter);
+                ptr->getter = getter;
+                PYPTR_XDECREF(ptr->setter);
+                PYPTR_XINCREF(setter);
+                ptr->setter = setter;
+                return 0;
+            }
+
+            inline static void dealloc(PyObject *self) {
+                auto ptr = reinterpret_cast<data*>(self);
+                PYPTR_CLEAR(ptr->name);
+                PYPTR_CLEAR(ptr->getter);
+                PYPTR_CLEAR(ptr->setter);
+            }
+
+            inline static PyObject *get(PyObject *self, PyObject *obj, PyObject *type) {
+                if (self == nullptr || obj == nullptr) {
+                    PYPTR_XINCREF(self);
+                    return self;
+                }
+                auto ptr = reinterpret_cast<data*>(self);
+                return PyObject_CallFunctionObjArgs(ptr->getter, obj, nullptr);
+            }
+
+            inline static int set(PyObject *self, PyObject *obj, PyObject *value) {
+                if (self == nullptr || obj == nullptr || value == nullptr) {
+                    return -1;
+                }
+                auto ptr = reinterpret_cast<data*>(self);
+                if (ptr->setter == nullptr) {
+                    PyErr_SetString(PyExc_AttributeError, "can't set attribute");
+                    return -1;
+                }
+                auto res = PyObject_CallFunctionObjArgs(ptr->setter, obj, value, nullptr);
+                if (res == nullptr) {
+                    return -1;
+                }
+                PYPTR_DECREF(res);
+                return 0;
+            }
+
+            inline py_type<py_ptr> operator()() {
+                gil _gil;
+                auto type = reinterpret_cast<PyHeapTypeObject*>(PyType_GenericAlloc(&PyType_Type, 0));
+                if (type == nullptr) {
+                    throw_pyerr();
+                    return nullptr;
+                }
+                type->ht_type.tp_name = "pyptr.property";
+                type->ht_type.tp_basicsize = sizeof(data);
+                type->ht_type.tp_alloc = PyType_GenericAlloc;
+                type->ht_type.tp_init = init;
+                type->ht_type.tp_dealloc = dealloc;
+                type->ht_type.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HEAPTYPE;
+                type->ht_type.tp_descr_get = get;
+                type->ht_type.tp_descr_set = set;
+                auto lastNamePart = strrchr(type->ht_type.tp_name, '.');
+                if (!lastNamePart) {
+                    lastNamePart = type->ht_type.tp_name;
+                }
+                py_str nameobj(lastNamePart);
+                type->ht_name = static_cast<PyObject*>(borrow(nameobj));
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 3
+                type->ht_qualname = static_cast<PyObject*>(borrow(nameobj));
+#endif
+
+                if (type == nullptr || PyType_Ready(&type->ht_type) < 0) {
+                    PYPTR_XDECREF(type);
+                    throw_pyerr();
+                    return nullptr;
+                }
+                return steal(reinterpret_cast<PyObject*>(type));
+            }
+        };
+
+        // Implements the buffer protocol for class_factory types over the
+        // memory returned by the getter stored in the type's
+        // __pyptr_buffer__ capsule, so each type keeps its own getter.
+        template<typename TInner>
+        struct buffer_export {
+            struct range {
+                void *data;
+                Py_ssize_t count;
+                Py_ssize_t itemsize;
+                const char *format;
+                bool readonly;
+            };
+
+            // Kept with the view until it is released
+            struct view_info {
+                Py_ssize_t shape;
+                buffer_exports *exports;
+            };
+
+            typedef ::std::function<range(TInner&)> getter;
+
+            // Subclasses find the getter of the class_factory type they
+            // derive from. The capsule is returned with a reference, which
+            // keeps the getter alive while it runs.
+            static py_ptr find_getter(PyObject *self, getter *&fn) {
+                py_ptr caps(steal(PyObject_GetAttr(reinterpret_cast<PyObject*>(Py_TYPE(self)), PYPTR_STR("__pyptr_buffer__"))));
+                if (!caps) {
+                    if (PyErr_ExceptionMatches(PyExc_AttributeError)) {
+                        PyErr_Clear();
+                        PyErr_SetString(PyExc_BufferError, "type has no buffer getter");
+                    }
+                    return caps;
+                }
+#if PY_MAJOR_VERSION == 2 && PY_MINOR_VERSION <= 6
+                fn = *py_capsule<getter>(borrow(caps));
+#else
+                fn = reinterpret_cast<getter*>(PyCapsule_GetPointer(caps, typeid(py_capsule<getter>).name()));
+                if (fn == nullptr) {
+                    return py_ptr();
+                }
+#endif
+                return caps;
+            }
+
+            template<typename TRange>
+            static range range_of(TRange&& r) {
+                typedef typename ::std::remove_pointer<decltype(r.data())>::type TItem;
+                range result = {
+                    const_cast<void*>(static_cast<const void*>(r.data())),
+                    static_cast<Py_ssize_t>(r.size()),
+                    static_cast<Py_ssize_t>(sizeof(TItem)),
+                    buffer_format<TItem>::value(),
+                    ::std::is_const<TItem>::value
+                };
+                return result;
+            }
+
+            static buffer_exports *exports_of(buffer_exports *inner) { return inner; }
+            static buffer_exports *exports_of(void *) { return nullptr; }
+
+            static int get(PyObject *self, Py_buffer *view, int flags) {
+                try {
+                    py_object<TInner> obj(borrow(self));
+                    if (*obj == nullptr) {
+                        PyErr_SetString(PyExc_BufferError, "object is not initialized");
+                        return -1;
+                    }
+                    getter *fn = nullptr;
+                    auto caps = find_getter(self, fn);
+                    if (!caps) {
+                        return -1;
+                    }
+                    auto r = (*fn)(**obj);
+                    if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE && r.readonly) {
+                        PyErr_SetString(PyExc_BufferError, "Object is not writable.");
+                        return -1;
+                    }
+
+                    auto info = new view_info();
+                    info->shape = r.count;
+                    info->exports = exports_of(*obj);
+                    if (info->exports != nullptr) {
+                        ++info->exports->_exports;
+                    }
+
+                    PYPTR_INCREF(self);
+                    view->obj = self;
+                    view->buf = r.data;
+                    view->len = r.count * r.itemsize;
+                    view->itemsize = r.itemsize;
+                    view->readonly = r.readonly ? 1 : 0;
+                    view->ndim = 1;
+                    view->format = (flags & PyBUF_FORMAT) == PyBUF_FORMAT ? const_cast<char*>(r.format) : nullptr;
+                    view->shape = (flags & PyBUF_ND) == PyBUF_ND ? &info->shape : nullptr;
+                    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &view->itemsize : nullptr;
+                    view->suboffsets = nullptr;
+                    view->internal = info;
+                    return 0;
+                } catch (const ::std::exception& exc) {
+                    set_pyerr(exc);
+                    return -1;
+                }
+            }
+
+            static void release(PyObject *, Py_buffer *view) {
+                auto info = static_cast<view_info*>(view->internal);
+                if (info->exports != nullptr) {
+                    --info->exports->_exports;
+                }
+                delete info;
+                view->internal = nullptr;
+            }
+        };
+
+        template <typename TGetter, typename TSetter>
+        struct property_proxy {
+            TGetter get;
+            TSetter set;
+
+            property_proxy(TGetter get, TSetter set)
+                : get(get), set(set) { }
+        };
+
+        template<typename TInner>
+        class class_member_proxy {
+            typedef typename class_factory<TInner>::Type Type;
+            typedef typename class_factory<TInner>::Instance Instance;
+
+            class_factory<TInner>& owner;
+            const char *name;
+
+        public:
+            class_member_proxy(const char *name, class_factory<TInner>& owner)
+                : name(name), owner(owner) { }
+
+            // Add data member
+            class_member_proxy<TInner>& operator =(const py_ptr& value) {
+                owner._members[name] = value;
+                return *this;
+            }
+
+            // Add instance method
+            template<typename TResult, typename... Ts>
+            class_member_proxy<TInner>& operator =(TResult (*value)(Instance, Ts...)) {
+                gil _gil;
+                auto descr = _gil.current_interpreter().get_or_make_static_ptr<details::instance_method_descriptor_maker>();
+                owner._members[name] = python::call(descr, py_str(name), details::make_named_callback(value, name));
+                return *this;
+            }
+
+            // Add implicit instance method
+            template<typename TResult, typename... Ts>
+            class_member_proxy<TInner>& operator =(TResult (TInner::*value)(Ts...)) {
+                gil _gil;
+                auto descr = _gil.current_interpreter().get_or_make_static_ptr<details::instance_method_descriptor_maker>();
+                owner._members[name] = python::call(descr, py_str(name), details::make_named_callback(value, name));
+                return *this;
+            }
+
+            // Add implicit instance method with keyword names
+            template<typename TResult, typename... Ts>
+            class_member_proxy<TInner>& operator =(const py_callback<TResult, TInner, Ts...>& value) {
+                gil _gil;
+                auto descr = _gil.current_interpreter().get_or_make_static_ptr<details::instance_method_descriptor_maker>();
+                py_callback<TResult, TInner, Ts...> callback(value);
+                callback.set_name(name);
+                owner._members[name] = python::call(descr, py_str(name), callback);
+                return *this;
+            }
+
+            // Add class method
+            template<typename TResult, typename... Ts>
+            class_member_proxy<TInner>& operator =(TResult(*value)(Type, Ts...)) {
+                gil _gil;
+                auto descr = _gil.current_interpreter().get_or_make_static_ptr<details::class_method_descriptor_maker>();
+                owner._members[name] = python::call(descr, py_str(name), details::make_named_callback(value, name));
+                return *this;
+            }
+
+            // Add overloaded instance method
+            class_member_proxy<TInner>& operator =(const py_overloads& value) {
+                gil _gil;
+                auto descr = _gil.current_interpreter().get_or_make_static_ptr<details::instance_method_descriptor_maker>();
+                py_overloads named(value);
+                named.set_name(name);
+                owner._members[name] = python::call(descr, py_str(name), named);
+                return *this;
+            }
+
+            // Add static method
+            template<typename TResult, typename... Ts>
+            class_member_proxy<TInner>& operator =(const py_callback<TResult, void, Ts...>& value) {
+                owner._members[name] = value;
+                return *this;
+            }
+
+            template<typename TFunction>
+            class_member_proxy<TInner>& operator =(TFunction *fn) {
+                return operator =(make_callback(fn));
+            }
+
+            template<typename TGetter, typename TSetter>
+            class_member_proxy<TInner>& operator =(const property_proxy<TGetter, TSetter>& value) {
+                gil _gil;
+                auto descr = _gil.current_interpreter().get_or_make_static_ptr<details::property_descriptor_maker>();
+                owner._members[name] = python::call(descr, py_str(name), value.get, value.set);
+                return *this;
+            }
+
+            template<typename TGetter>
+            class_member_proxy<TInner>& operator =(const property_proxy<TGetter, nullptr_t>& value) {
+                gil _gil;
+                auto descr = _gil.current_interpreter().get_or_make_static_ptr<details::property_descriptor_maker>();
+                owner._members[name] = python::call(descr, py_str(name), value.get);
+                return *this;
+            }
+        };
+    }
+
+    template<typename TResult, typename... Ts>
+    py_ptr static_method(const py_callback<TResult, void, Ts...>& value) {
+        return value;
+    }
+
+    template<typename TFunction>
+    py_ptr static_method(TFunction *fn) {
+        return static_method(make_callback(fn));
+    }
+
+    template<typename TSelf, typename TResult1, typename TResult2>
+    details::property_proxy<py_callback<TResult1,void,py_object<TSelf>>, py_callback<void,void,py_object<TSelf>,TResult1>>
+    property(TResult1 (*get)(py_object<TSelf>), void (*set)(py_object<TSelf>, TResult2)) {
+        static_assert(::std::is_same<TResult1, TResult2>::value, "getter and setter must have same value type");
+        return{ get, set };
+    }
+
+    template<typename TSelf, typename TResult1, typename TResult2>
+    details::property_proxy<py_callback<TResult1,TSelf>, py_callback<void,TSelf,TResult1>>
+    property(TResult1(TSelf::*get)(), void(TSelf::*set)(TResult2)) {
+        static_assert(::std::is_same<TResult1, TResult2>::value, "getter and setter must have same value type");
+        return{ get, set };
+    }
+
+    template<typename TSelf, typename TResult>
+    details::property_proxy<py_callback<TResult,void,py_object<TSelf>>, nullptr_t>
+    property(TResult (*get)(py_object<TSelf>)) {
+        return{ get, nullptr };
+    }
+
+    template<typename TSelf, typename TResult>
+    details::property_proxy<py_callback<TResult, TSelf>, nullptr_t>
+    property(TResult(TSelf::*get)()) {
+        return{ get, nullptr };
+    }
+
+    template<typename TInner>
+    class class_factory {
+        friend details::class_member_proxy<TInner>;
+    public:
+        typedef py_object<TInner> Instance;
+        typedef py_type<TInner> Type;
+
+    private:
+        typedef details::inline_storage<TInner> Storage;
+
+        Type _type;
+        py_str _name;
+        py_dict<py_str, py_ptr> _members;
+        bool _inline;
+        bool _buffer;
+
+        static int call_init(const py_object<TInner>& obj, PyObject *args, PyObject *kwargs) {
+            auto initObj = getattr(obj, PYPTR_STR("__pyptr_init__"), (py_callable<py_ptr>)nullptr);
+            if (initObj) {
+                py_ptr res(steal(PyObject_Call(initObj, args, kwargs)));
+                return res ? 0 : 1;
+            }
+            return 0;
+        }
+
+        static int init(PyObject *self, PyObject *args, PyObject *kwargs) {
+            py_object<TInner> obj(borrow(self), new TInner());
+            return call_init(obj, args, kwargs);
+        }
+
+        static int init_inline(PyObject *self, PyObject *args, PyObject *kwargs) {
+            auto storage = reinterpret_cast<typename Storage::object*>(self);
+            if (!storage->constructed) {
+                new (&storage->value) TInner();
+                storage->constructed = true;
+            }
+            return call_init(py_object<TInner>(borrow(self)), args, kwargs);
+        }
+
+        static void dealloc_inline(PyObject *self) {
+            auto storage = reinterpret_cast<typename Storage::object*>(self);
+            if (storage->constructed) {
+                storage->constructed = false;
+                reinterpret_cast<TInner*>(&storage->value)->~TInner();
+            }
+            auto tp = Py_TYPE(self);
+            tp->tp_free(self);
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 8
+            // subtype_dealloc leaves the type reference to heap type bases
+            PYPTR_DECREF(tp);
+#endif
+        }
+
+        // Deallocates instances of a base that holds nothing itself
+        static void dealloc_base(PyObject *self) {
+            auto tp = Py_TYPE(self);
+            tp->tp_free(self);
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 8
+            PYPTR_DECREF(tp);
+#endif
+        }
+
+        // Creates the base type that reserves room for TInner in each
+        // instance when it is inline, and carries the buffer slots. The
+        // type and any Python subclass inherit the slots when they are
+        // created, which they would not if the slots were set afterwards.
+        inline py_type<py_ptr> make_base() const {
+            const char *name = _inline ? "pyptr.inline_object" : "pyptr.buffer_object";
+            int size = static_cast<int>(_inline ? sizeof(typename Storage::object) : sizeof(PyObject));
+            auto dealloc = _inline ? dealloc_inline : dealloc_base;
+#if PY_MAJOR_VERSION == 3
+            PyType_Slot slots[5] = {
+                { Py_tp_new, reinterpret_cast<void*>(PyType_GenericNew) },
+                { Py_tp_dealloc, reinterpret_cast<void*>(dealloc) }
+            };
+#if PY_MINOR_VERSION >= 9
+            if (_buffer) {
+                slots[2].slot = Py_bf_getbuffer;
+                slots[2].pfunc = reinterpret_cast<void*>(details::buffer_export<TInner>::get);
+                slots[3].slot = Py_bf_releasebuffer;
+                slots[3].pfunc = reinterpret_cast<void*>(details::buffer_export<TInner>::release);
+            }
+#endif
+            PyType_Spec spec = { name, size, 0, Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, slots };
+            auto type = PyType_FromSpec(&spec);
+            if (type == nullptr) {
+                details::throw_pyerr();
+            }
+#if PY_MINOR_VERSION < 9
+            // Buffer slots are not accepted in a spec before 3.9. Nothing
+            // derives from the type yet, so they can still be filled in.
+            if (_buffer) {
+                auto ht = reinterpret_cast<PyHeapTypeObject*>(type);
+                ht->as_buffer.bf_getbuffer = details::buffer_export<TInner>::get;
+                ht->as_buffer.bf_releasebuffer = details::buffer_export<TInner>::release;
+                ht->ht_type.tp_as_buffer = &ht->as_buffer;
+                PyType_Modified(&ht->ht_type);
+            }
+#endif
+            return steal(type);
+#elif PY_MAJOR_VERSION == 2
+            // There are no type specs before Python 3
+            auto type = reinterpret_cast<PyHeapTypeObject*>(PyType_GenericAlloc(&PyType_Type, 0));
+            if (type == nullptr) {
+                details::throw_pyerr();
+            }
+            type->ht_type.tp_name = name;
+            type->ht_type.tp_basicsize = size;
+            type->ht_type.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HEAPTYPE | Py_TPFLAGS_BASETYPE;
+            type->ht_type.tp_alloc = PyType_GenericAlloc;
+            type->ht_type.tp_new = PyType_GenericNew;
+            type->ht_type.tp_free = PyObject_Del;
+            type->ht_type.tp_dealloc = dealloc;
+            type->ht_name = py_str(_inline ? "inline_object" : "buffer_object").detach();
+            if (_buffer) {
+                type->as_buffer.bf_getbuffer = details::buffer_export<TInner>::get;
+                type->as_buffer.bf_releasebuffer = details::buffer_export<TInner>::release;
+                type->ht_type.tp_as_buffer = &type->as_buffer;
+                type->ht_type.tp_flags |= Py_TPFLAGS_HAVE_NEWBUFFER;
+            }
+            if (PyType_Ready(&type->ht_type) < 0) {
+                PYPTR_DECREF(type);
+                details::throw_pyerr();
+            }
+            return steal(reinterpret_cast<PyObject*>(type));
+#endif
+        }
+
+        inline void construct_type() {
+            if (_type) {
+                return;
+            }
+
+            auto nameParts = _name.rpartition(".");
+            _members.setdefault("__module__", nameParts.get<0>());
+            auto initObj = _members.get("__init__");
+            if (initObj) {
+                _members["__pyptr_init__"] = initObj;
+                _members.del("__init__");
+            }
+            if (_inline || _buffer) {
+                if (_inline) {
+                    // No __dict__, so the instance is exactly the base layout
+                    _members.setdefault("__slots__", py_tuple<>::empty());
+                }
+                Type base(borrow(make_base()));
+                _type = Type(nameParts.get<2>(), make_py_tuple(base), ::std::move(_members));
+            } else {
+                _type = Type(nameParts.get<2>(), ::std::move(_members));
+            }
+            auto tp = reinterpret_cast<PyTypeObject*>(static_cast<PyObject*>(_type));
+            tp->tp_init = _inline ? init_inline : init;
+            details::type_registry::get_or_create().add(tp, typeid(TInner), _inline);
+            _name = nullptr;
+            _members = nullptr;
+        }
+    public:
+        explicit class_factory(py_str name) : _name(name), _members(py_dict<py_str, py_ptr>::empty()), _inline(false), _buffer(false) { }
+
+        // With inlineStorage, each TInner is constructed inside its Python
+        // instance rather than allocated separately and attached through
+        // __pyptr_ptr__. Such instances have no __dict__.
+        class_factory(py_str name, bool inlineStorage)
+            : _name(name), _members(py_dict<py_str, py_ptr>::empty()), _inline(inlineStorage), _buffer(false) { }
+
+        inline Type get_type() {
+            construct_type();
+            return _type;
+        }
+
+        inline Instance create_instance() {
+            return call(get_type());
+        }
+
+        inline details::class_member_proxy<TInner> operator[](const char *name) {
+            return details::class_member_proxy<TInner>(name, *this);
+        }
+
+        // Exports the memory returned by getter through the buffer protocol,
+        // so that memoryview and NumPy can use it without copying. The
+        // result needs data() and size(), such as a span or a reference to
+        // a vector, and must refer to memory owned by the instance. Classes
+        // deriving from buffer_exports can refuse to resize while views
+        // are alive.
+        template<typename TResult>
+        void buffer(TResult (TInner::*getter)()) {
+            set_buffer([getter](TInner& inner) {
+                return details::buffer_export<TInner>::range_of((inner.*getter)());
+            });
+        }
+
+        template<typename TResult>
+        void buffer(TResult (TInner::*getter)() const) {
+            set_buffer([getter](TInner& inner) {
+                return details::buffer_export<TInner>::range_of((inner.*getter)());
+            });
+        }
+
+    private:
+        // The getter is kept in a capsule on the type and released with it.
+        // The slots go on the base the type is created from, so the getter
+        // has to be known by then.
+        template<typename TGetter>
+        inline void set_buffer(TGetter getter) {
+            typedef typename details::buffer_export<TInner>::getter Getter;
+            if (_type) {
+                PyErr_SetString(PyExc_TypeError, "buffer() must be called before the type is created");
+                details::throw_pyerr();
+            }
+            py_capsule<Getter> caps(new Getter(getter));
+            _members["__pyptr_buffer__"] = caps;
+            _buffer = true;
+        }
+    };
+}
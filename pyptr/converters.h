@@ -0,0 +1,395 @@
+#pragma once
+
+#include "py_ptr.h"
+#include "primitives.h"
+#include "strings.h"
+
+#include <climits>
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#ifdef pyptr_HAS_STRING_VIEW
+#include <string_view>
+#endif
+#ifdef pyptr_HAS_SPAN
+#include <span>
+#endif
+
+namespace python {
+    namespace details {
+        // Converts a borrowed argument into the parameter type of a C++
+        // callback. The default goes through the matching py_* wrapper; the
+        // specializations below read native values straight from the object
+        // without touching its reference count.
+        // check() reports whether an argument is of a type convert() accepts,
+        // and is used to choose between overloads.
+        template<typename T>
+        struct arg_converter {
+            typedef typename pyptr_type<T>::type type;
+
+            static inline bool check(PyObject *arg) {
+                return check_ptr<type>::check(arg);
+            }
+
+            static inline type convert(PyObject *arg) {
+                return type(borrow(arg));
+            }
+        };
+
+        template<typename T> struct arg_converter<const T> : arg_converter<T> { };
+        template<typename T> struct arg_converter<const T&> : arg_converter<T> { };
+
+        // Whether arg_converter<T>::check looks at the argument's value as
+        // well as its type. Overload choices that depend on such a check
+        // are not cached by type.
+        template<typename T> struct check_depends_on_value : ::std::false_type { };
+        template<typename T> struct check_depends_on_value<const T> : check_depends_on_value<T> { };
+        template<typename T> struct check_depends_on_value<const T&> : check_depends_on_value<T> { };
+
+        template<>
+        struct arg_converter<bool> {
+            typedef bool type;
+
+            static inline bool check(PyObject *arg) {
+                return PyBool_Check(arg) != 0;
+            }
+
+            static inline bool convert(PyObject *arg) {
+                if (arg == Py_True) {
+                    return true;
+                } else if (arg == Py_False) {
+                    return false;
+                }
+                int result = PyObject_IsTrue(arg);
+                if (result < 0) throw_pyerr();
+                return result != 0;
+            }
+        };
+
+        template<>
+        struct arg_converter<int> {
+            typedef int type;
+
+            static inline bool check(PyObject *arg) {
+                return PyLong_Check(arg) != 0;
+            }
+
+            static inline int convert(PyObject *arg) {
+                auto result = PyLong_AsLong(arg);
+                if (result == -1 && PyErr_Occurred()) throw_pyerr();
+                if (result < INT_MIN || result > INT_MAX) {
+                    PyErr_SetString(PyExc_OverflowError, "Python int too large to convert to C int");
+                    throw_pyerr();
+                }
+                return static_cast<int>(result);
+            }
+        };
+
+        template<>
+        struct arg_converter<unsigned int> {
+            typedef unsigned int type;
+
+            static inline bool check(PyObject *arg) {
+                return PyLong_Check(arg) != 0;
+            }
+
+            static inline unsigned int convert(PyObject *arg) {
+                auto result = PyLong_AsUnsignedLong(arg);
+                if (result == (unsigned long)-1 && PyErr_Occurred()) throw_pyerr();
+                if (result > UINT_MAX) {
+                    PyErr_SetString(PyExc_OverflowError, "Python int too large to convert to C unsigned int");
+                    throw_pyerr();
+                }
+                return static_cast<unsigned int>(result);
+            }
+        };
+
+        template<>
+        struct arg_converter<long> {
+            typedef long type;
+
+            static inline bool check(PyObject *arg) {
+                return PyLong_Check(arg) != 0;
+            }
+
+            static inline long convert(PyObject *arg) {
+                auto result = PyLong_AsLong(arg);
+                if (result == -1 && PyErr_Occurred()) throw_pyerr();
+                return result;
+            }
+        };
+
+        template<>
+        struct arg_converter<unsigned long> {
+            typedef unsigned long type;
+
+            static inline bool check(PyObject *arg) {
+                return PyLong_Check(arg) != 0;
+            }
+
+            static inline unsigned long convert(PyObject *arg) {
+                auto result = PyLong_AsUnsignedLong(arg);
+                if (result == (unsigned long)-1 && PyErr_Occurred()) throw_pyerr();
+                return result;
+            }
+        };
+
+        template<>
+        struct arg_converter<long long> {
+            typedef long long type;
+
+            static inline bool check(PyObject *arg) {
+                return PyLong_Check(arg) != 0;
+            }
+
+            static inline long long convert(PyObject *arg) {
+                auto result = PyLong_AsLongLong(arg);
+                if (result == -1 && PyErr_Occurred()) throw_pyerr();
+                return result;
+            }
+        };
+
+        template<>
+        struct arg_converter<unsigned long long> {
+            typedef unsigned long long type;
+
+            static inline bool check(PyObject *arg) {
+                return PyLong_Check(arg) != 0;
+            }
+
+            static inline unsigned long long convert(PyObject *arg) {
+                auto result = PyLong_AsUnsignedLongLong(arg);
+                if (result == (unsigned long long)-1 && PyErr_Occurred()) throw_pyerr();
+                return result;
+            }
+        };
+
+        template<>
+        struct arg_converter<double> {
+            typedef double type;
+
+            static inline bool check(PyObject *arg) {
+                return PyFloat_Check(arg) || PyLong_Check(arg);
+            }
+
+            static inline double convert(PyObject *arg) {
+                if (PyFloat_CheckExact(arg)) {
+                    return PyFloat_AS_DOUBLE(arg);
+                }
+                auto result = PyFloat_AsDouble(arg);
+                if (result == -1.0 && PyErr_Occurred()) throw_pyerr();
+                return result;
+            }
+        };
+
+        template<>
+        struct arg_converter<float> {
+            typedef float type;
+
+            static inline bool check(PyObject *arg) {
+                return arg_converter<double>::check(arg);
+            }
+
+            static inline float convert(PyObject *arg) {
+                return static_cast<float>(arg_converter<double>::convert(arg));
+            }
+        };
+
+        inline bool is_text(PyObject *arg) {
+#if PY_MAJOR_VERSION == 3
+            return PyUnicode_Check(arg) != 0;
+#elif PY_MAJOR_VERSION == 2
+            return PyString_Check(arg) != 0;
+#endif
+        }
+
+        // Reads the UTF-8 contents of a str. On Python 3 the encoded form is
+        // cached on the object, so it stays valid while the argument is alive.
+        inline const char *utf8_data(PyObject *arg, Py_ssize_t *size) {
+#if PY_MAJOR_VERSION == 3
+            auto data = PyUnicode_AsUTF8AndSize(arg, size);
+            if (data == nullptr) throw_pyerr();
+            return data;
+#elif PY_MAJOR_VERSION == 2
+            char *data;
+            if (PyString_AsStringAndSize(arg, &data, size) != 0) throw_pyerr();
+            return data;
+#endif
+        }
+
+        template<>
+        struct arg_converter<const char*> {
+            typedef const char *type;
+
+            static inline bool check(PyObject *arg) {
+                return is_text(arg);
+            }
+
+            static inline const char *convert(PyObject *arg) {
+                Py_ssize_t size;
+                return utf8_data(arg, &size);
+            }
+        };
+
+        template<>
+        struct arg_converter<::std::string> {
+            typedef ::std::string type;
+
+            static inline bool check(PyObject *arg) {
+                return is_text(arg);
+            }
+
+            static inline ::std::string convert(PyObject *arg) {
+                Py_ssize_t size;
+                auto data = utf8_data(arg, &size);
+                return ::std::string(data, static_cast<size_t>(size));
+            }
+        };
+
+#ifdef pyptr_HAS_STRING_VIEW
+        template<>
+        struct arg_converter<::std::string_view> {
+            typedef ::std::string_view type;
+
+            static inline bool check(PyObject *arg) {
+                return is_text(arg);
+            }
+
+            static inline ::std::string_view convert(PyObject *arg) {
+                Py_ssize_t size;
+                auto data = utf8_data(arg, &size);
+                return ::std::string_view(data, static_cast<size_t>(size));
+            }
+        };
+#endif
+
+        // The other direction: creates a new reference for a C++ value being
+        // stored in a container. The default goes through the pyptr_type
+        // wrapper; arithmetic and string values are created directly.
+        template<typename T>
+        struct item_boxer {
+            static inline PyObject *box(const T& value) {
+                return typename pyptr_type<T>::type(value).detach();
+            }
+        };
+
+        inline PyObject *checked_new(PyObject *obj) {
+            if (obj == nullptr) throw_pyerr();
+            return obj;
+        }
+
+        template<>
+        struct item_boxer<bool> {
+            static inline PyObject *box(bool value) {
+                auto obj = value ? Py_True : Py_False;
+                PYPTR_INCREF(obj);
+                return obj;
+            }
+        };
+
+#define PYPTR_ITEM_BOXER(T, EXPR) \
+        template<> \
+        struct item_boxer<T> { \
+            static inline PyObject *box(T value) { return checked_new(EXPR); } \
+        }
+
+        PYPTR_ITEM_BOXER(int, PyLong_FromLong(value));
+        PYPTR_ITEM_BOXER(unsigned int, PyLong_FromUnsignedLong(value));
+        PYPTR_ITEM_BOXER(long, PyLong_FromLong(value));
+        PYPTR_ITEM_BOXER(unsigned long, PyLong_FromUnsignedLong(value));
+        PYPTR_ITEM_BOXER(long long, PyLong_FromLongLong(value));
+        PYPTR_ITEM_BOXER(unsigned long long, PyLong_FromUnsignedLongLong(value));
+        PYPTR_ITEM_BOXER(float, PyFloat_FromDouble(value));
+        PYPTR_ITEM_BOXER(double, PyFloat_FromDouble(value));
+#undef PYPTR_ITEM_BOXER
+
+        inline PyObject *text_from_utf8(const char *data, size_t size) {
+#if PY_MAJOR_VERSION == 3
+            return checked_new(PyUnicode_FromStringAndSize(data, static_cast<Py_ssize_t>(size)));
+#elif PY_MAJOR_VERSION == 2
+            return checked_new(PyString_FromStringAndSize(data, static_cast<Py_ssize_t>(size)));
+#endif
+        }
+
+        template<>
+        struct item_boxer<::std::string> {
+            static inline PyObject *box(const ::std::string& value) {
+                return text_from_utf8(value.data(), value.size());
+            }
+        };
+
+#ifdef pyptr_HAS_STRING_VIEW
+        template<>
+        struct item_boxer<::std::string_view> {
+            static inline PyObject *box(::std::string_view value) {
+                return text_from_utf8(value.data(), value.size());
+            }
+        };
+#endif
+
+        template<typename TItem, typename TElement>
+        inline PyObject *box_item(const TItem& item, ::std::true_type) {
+            return item_boxer<TItem>::box(item);
+        }
+
+        template<typename TItem, typename TElement>
+        inline PyObject *box_item(const TItem& item, ::std::false_type) {
+            return detach<const TItem&, TElement>(item);
+        }
+
+        // Boxes an item for a container of TElement. Items that would be
+        // wrapped as TElement anyway take the direct path.
+        template<typename TItem, typename TElement>
+        inline PyObject *box_item(const TItem& item) {
+            typedef typename ::std::decay<TItem>::type TValue;
+            return box_item<TValue, TElement>(item, ::std::integral_constant<bool,
+                ::std::is_same<typename pyptr_type<TValue>::type, typename pyptr_type<TElement>::type>::value &&
+                !::std::is_base_of<_py_ptrbase, TValue>::value>());
+        }
+
+#ifdef pyptr_HAS_SPAN
+        // Holds a buffer for the duration of a call. bytes are immutable and
+        // read directly; anything else, including bytearray, is exported
+        // through the buffer protocol so it cannot be resized during the call.
+        struct byte_buffer_arg {
+            Py_buffer view;
+
+            byte_buffer_arg(PyObject *arg) {
+                if (PyBytes_CheckExact(arg)) {
+                    view.obj = nullptr;
+                    view.buf = PyBytes_AS_STRING(arg);
+                    view.len = PyBytes_GET_SIZE(arg);
+                } else if (PyObject_GetBuffer(arg, &view, PyBUF_SIMPLE) != 0) {
+                    throw_pyerr();
+                }
+            }
+
+            ~byte_buffer_arg() {
+                if (view.obj != nullptr) {
+                    PyBuffer_Release(&view);
+                }
+            }
+
+            byte_buffer_arg(const byte_buffer_arg&) = delete;
+            byte_buffer_arg& operator =(const byte_buffer_arg&) = delete;
+
+            operator ::std::span<const ::std::byte>() const {
+                return { reinterpret_cast<const ::std::byte*>(view.buf), static_cast<size_t>(view.len) };
+            }
+        };
+
+        template<>
+        struct arg_converter<::std::span<const ::std::byte>> {
+            typedef byte_buffer_arg type;
+
+            static inline bool check(PyObject *arg) {
+                return PyObject_CheckBuffer(arg) != 0;
+            }
+
+            static inline byte_buffer_arg convert(PyObject *arg) {
+                return byte_buffer_arg(arg);
+            }
+        };
+#endif
+    }
+}
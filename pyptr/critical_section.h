@@ -0,0 +1,87 @@
+#pragma once
+
+//
+// Free-threaded CPython support. In a build with Py_GIL_DISABLED, the GIL
+// no longer serializes access to objects, so compound operations in the
+// wrappers lock the objects they touch with a critical section. Without
+// it, these types compile to nothing and the GIL provides the exclusion.
+//
+
+#if defined(Py_GIL_DISABLED)
+#define pyptr_FREE_THREADED
+#endif
+
+namespace python {
+    // Locks an object for the lifetime of the scope, like
+    // Py_BEGIN_CRITICAL_SECTION/Py_END_CRITICAL_SECTION. Critical sections
+    // are reentrant for the same object, and may be suspended while the
+    // thread blocks, so they do not deadlock against each other.
+    class critical_section {
+#ifdef pyptr_FREE_THREADED
+        PyCriticalSection _cs;
+
+    public:
+        explicit critical_section(PyObject *obj) {
+            PyCriticalSection_Begin(&_cs, obj);
+        }
+
+        ~critical_section() {
+            PyCriticalSection_End(&_cs);
+        }
+#else
+    public:
+        explicit critical_section(PyObject *) { }
+#endif
+
+        critical_section(const critical_section&) = delete;
+        critical_section& operator =(const critical_section&) = delete;
+    };
+
+    // Locks two objects at once, in an order that cannot deadlock.
+    class critical_section2 {
+#ifdef pyptr_FREE_THREADED
+        PyCriticalSection2 _cs;
+
+    public:
+        critical_section2(PyObject *a, PyObject *b) {
+            PyCriticalSection2_Begin(&_cs, a, b);
+        }
+
+        ~critical_section2() {
+            PyCriticalSection2_End(&_cs);
+        }
+#else
+    public:
+        critical_section2(PyObject *, PyObject *) { }
+#endif
+
+        critical_section2(const critical_section2&) = delete;
+        critical_section2& operator =(const critical_section2&) = delete;
+    };
+
+    namespace details {
+        // Guards native state that the GIL protects in a default build.
+        // PyMutex detaches the thread state while it waits, so a thread
+        // blocked here does not hold up a stop-the-world pause for the
+        // thread holding the lock.
+#ifdef pyptr_FREE_THREADED
+        class free_threaded_mutex {
+            PyMutex _mutex;
+
+        public:
+            free_threaded_mutex() : _mutex() { }
+
+            free_threaded_mutex(const free_threaded_mutex&) = delete;
+            free_threaded_mutex& operator =(const free_threaded_mutex&) = delete;
+
+            void lock() { PyMutex_Lock(&_mutex); }
+            void unlock() { PyMutex_Unlock(&_mutex); }
+        };
+#else
+        struct free_threaded_mutex {
+            void lock() { }
+            void unlock() { }
+        };
+#endif
+    }
+}
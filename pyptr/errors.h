@@ -1,27 +1,344 @@
-#pragma once
-
-#include "py_ptr.h"
-
-namespace python {
-    namespace details {
-        inline void throw_pyerr() {
-            if (PyErr_Occurred()) {
-                PyObject *exc_type, *exc_value, *trace;
-                PyErr_Fetch(&exc_type, &exc_value, &trace);
-                PyErr_NormalizeException(&exc_type, &exc_value, &trace);
-                auto what = static_cast<::std::string>(format("%s: %s", make_py_tuple(getattr<py_str>(py_ptr(borrow(exc_type)), "__name__"), borrow(exc_value))));
-                Py_XDECREF(exc_value);
-                Py_XDECREF(trace);
-                PyErr_Clear();
-                // TODO: Throw correct error
-                if (exc_type == PyExc_RuntimeError) {
-                    Py_DECREF(exc_type);
-                    throw ::std::runtime_error(what.c_str());
-                }
-                Py_XDECREF(exc_type);
-                throw ::std::exception(what.c_str());
-            }
-        }
-    }
-}
-
+#pragma once
+
+#include "py_ptr.h"
+#include "interpreter_state.h"
+
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace python {
+    namespace details {
+        // Whether the calling thread has a thread state attached, and so
+        // holds the GIL, whichever interpreter it is running.
+        inline bool thread_attached() {
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 13
+            return PyThreadState_GetUnchecked() != nullptr;
+#elif PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 5
+            return _PyThreadState_UncheckedGet() != nullptr;
+#else
+            return gil_tls().held;
+#endif
+        }
+
+        // Takes the GIL for the scope unless the thread already holds it.
+        // A thread running a sub-interpreter has its own thread state
+        // attached and must not go through PyGILState, which only knows the
+        // main interpreter.
+        class ensure_gil {
+            bool _ensured;
+            PyGILState_STATE _state;
+
+        public:
+            ensure_gil() : _ensured(!thread_attached()) {
+                if (_ensured) {
+                    _state = PyGILState_Ensure();
+                }
+            }
+
+            ~ensure_gil() {
+                if (_ensured) {
+                    PyGILState_Release(_state);
+                }
+            }
+
+            ensure_gil(const ensure_gil&) = delete;
+            ensure_gil& operator =(const ensure_gil&) = delete;
+        };
+    }
+
+    // A Python exception travelling through C++. The fetched exception
+    // objects are kept as they are, and the message is only formatted if
+    // what() is called.
+    class error : public ::std::runtime_error {
+        // Exceptions are copied and destroyed wherever C++ unwinds, which
+        // may be without the GIL. The objects are shared by the copies and
+        // released under the GIL by the last one.
+        struct objects {
+            PyObject *type, *value, *trace;
+
+            objects(py_ptr type, py_ptr value, py_ptr trace)
+                : type(type.detach()), value(value.detach()), trace(trace.detach()) { }
+
+            ~objects() {
+                // After finalization the objects are gone with the interpreter
+                if (!Py_IsInitialized()) {
+                    return;
+                }
+                details::ensure_gil gil;
+                PYPTR_XDECREF(type);
+                PYPTR_XDECREF(value);
+                PYPTR_XDECREF(trace);
+            }
+
+            objects(const objects&) = delete;
+            objects& operator =(const objects&) = delete;
+        };
+
+        ::std::shared_ptr<const objects> _objects;
+        mutable ::std::string _what;
+        mutable bool _formatted;
+
+        static const char *text_of(PyObject *str) {
+#if PY_MAJOR_VERSION == 3
+            return PyUnicode_AsUTF8(str);
+#elif PY_MAJOR_VERSION == 2
+            return PyString_AsString(str);
+#endif
+        }
+
+        static py_ptr reference(PyObject *obj) {
+            return obj != nullptr ? py_ptr(borrow(obj)) : py_ptr();
+        }
+
+        void format() const {
+            details::ensure_gil gil;
+            PyObject *saved_type, *saved_value, *saved_trace;
+            PyErr_Fetch(&saved_type, &saved_value, &saved_trace);
+
+            PyObject *type = _objects->type, *value = _objects->value, *trace = _objects->trace;
+            PYPTR_XINCREF(type);
+            PYPTR_XINCREF(value);
+            PYPTR_XINCREF(trace);
+            PyErr_NormalizeException(&type, &value, &trace);
+
+            if (type != nullptr && PyType_Check(type)) {
+                _what = reinterpret_cast<PyTypeObject*>(type)->tp_name;
+            } else {
+                _what = "<unknown error>";
+            }
+            auto str = value != nullptr ? PyObject_Str(value) : nullptr;
+            auto text = str != nullptr ? text_of(str) : nullptr;
+            if (text != nullptr && *text) {
+                _what += ": ";
+                _what += text;
+            }
+            PYPTR_XDECREF(str);
+            PYPTR_XDECREF(type);
+            PYPTR_XDECREF(value);
+            PYPTR_XDECREF(trace);
+
+            PyErr_Restore(saved_type, saved_value, saved_trace);
+        }
+
+    public:
+        error(py_ptr type, py_ptr value, py_ptr trace)
+            : ::std::runtime_error(""), _objects(::std::make_shared<const objects>(type, value, trace)), _formatted(false) { }
+
+        error(py_ptr type, py_ptr value)
+            : ::std::runtime_error(""), _objects(::std::make_shared<const objects>(type, value, py_ptr())), _formatted(false) { }
+
+        // Takes the current Python error, which must be set.
+        static error fetch() {
+            PyObject *type, *value, *trace;
+            PyErr_Fetch(&type, &value, &trace);
+            return error(steal(type), steal(value), steal(trace));
+        }
+
+        // These need the GIL, as for any other object
+        py_ptr type() const { return reference(_objects->type); }
+        py_ptr value() const { return reference(_objects->value); }
+        py_ptr traceback() const { return reference(_objects->trace); }
+
+        bool matches(PyObject *exc_type) const {
+            return _objects->type != nullptr && PyErr_GivenExceptionMatches(_objects->type, exc_type) != 0;
+        }
+
+        // Sets this as the current Python error.
+        void restore() const {
+            if (_objects->type == nullptr) {
+                PyErr_SetString(PyExc_SystemError, "error restored without an exception type");
+                return;
+            }
+            PYPTR_INCREF(_objects->type);
+            PYPTR_XINCREF(_objects->value);
+            PYPTR_XINCREF(_objects->trace);
+            PyErr_Restore(_objects->type, _objects->value, _objects->trace);
+        }
+
+        const char *what() const noexcept override {
+            if (!_formatted) {
+                try {
+                    format();
+                } catch (...) {
+                    return "python::error";
+                }
+                _formatted = true;
+            }
+            return _what.c_str();
+        }
+    };
+
+#define PYPTR_ERROR_TYPE(NAME, EXC) \
+    class NAME : public error { \
+    public: \
+        NAME(py_ptr type, py_ptr value, py_ptr trace) : error(type, value, trace) { } \
+        explicit NAME(py_ptr value = nullptr) : error(borrow(EXC), value) { } \
+    }
+
+    PYPTR_ERROR_TYPE(key_error, PyExc_KeyError);
+    PYPTR_ERROR_TYPE(index_error, PyExc_IndexError);
+    PYPTR_ERROR_TYPE(stop_iteration, PyExc_StopIteration);
+    PYPTR_ERROR_TYPE(type_error, PyExc_TypeError);
+    PYPTR_ERROR_TYPE(value_error, PyExc_ValueError);
+    PYPTR_ERROR_TYPE(attribute_error, PyExc_AttributeError);
+
+    namespace details {
+        // Each mapping converts in one or both directions: a Python
+        // exception of (a subclass of) pytype is thrown as the C++ type, and
+        // a C++ exception of (a subclass of) the C++ type is raised as pytype.
+        struct exception_mapping {
+            typedef void (*to_cpp_function)(py_ptr type, py_ptr value, py_ptr trace);
+
+            PyObject *pytype;
+            to_cpp_function to_cpp;
+            bool (*to_python)(const ::std::exception& exc, PyObject *pytype);
+        };
+
+        template<typename T>
+        struct exception_translator {
+            static void throw_error(py_ptr type, py_ptr value, py_ptr trace, ::std::true_type) {
+                throw T(type, value, trace);
+            }
+
+            static void throw_error(py_ptr type, py_ptr value, py_ptr trace, ::std::false_type) {
+                throw T(error(type, value, trace).what());
+            }
+
+            static void to_cpp(py_ptr type, py_ptr value, py_ptr trace) {
+                throw_error(type, value, trace, ::std::is_base_of<error, T>());
+            }
+
+            static bool to_python(const ::std::exception& exc, PyObject *pytype) {
+                if (dynamic_cast<const T*>(&exc) == nullptr) {
+                    return false;
+                }
+                PyErr_SetString(pytype, exc.what());
+                return true;
+            }
+        };
+
+        // There is one registry per interpreter, kept with the other pyptr
+        // statics in its interpreter_state, since the exception types are
+        // objects of that interpreter.
+        class exception_registry {
+            ::std::vector<exception_mapping> _mappings;
+            mutable free_threaded_mutex _lock;
+
+            template<typename T>
+            void add_both(PyObject *pytype) {
+                add(pytype, exception_translator<T>::to_cpp, exception_translator<T>::to_python);
+            }
+
+            template<typename T>
+            void add_to_python(PyObject *pytype) {
+                add(pytype, nullptr, exception_translator<T>::to_python);
+            }
+
+            friend class interpreter_state;
+
+            exception_registry() {
+                add_to_python<::std::exception>(PyExc_Exception);
+                add_to_python<::std::runtime_error>(PyExc_RuntimeError);
+                add_to_python<::std::invalid_argument>(PyExc_ValueError);
+                add_to_python<::std::out_of_range>(PyExc_IndexError);
+                add_to_python<::std::overflow_error>(PyExc_OverflowError);
+                add_to_python<::std::bad_alloc>(PyExc_MemoryError);
+                add_both<key_error>(PyExc_KeyError);
+                add_both<index_error>(PyExc_IndexError);
+                add_both<stop_iteration>(PyExc_StopIteration);
+                add_both<type_error>(PyExc_TypeError);
+                add_both<value_error>(PyExc_ValueError);
+                add_both<attribute_error>(PyExc_AttributeError);
+            }
+
+        public:
+            ~exception_registry() {
+                for (auto& m : _mappings) {
+                    PYPTR_DECREF(m.pytype);
+                }
+            }
+
+            exception_registry(const exception_registry&) = delete;
+            exception_registry& operator =(const exception_registry&) = delete;
+
+            // The registry for the calling thread's interpreter
+            static exception_registry& get() {
+                return interpreter_state::get().native<exception_registry>();
+            }
+
+            void add(PyObject *pytype, exception_mapping::to_cpp_function to_cpp, bool (*to_python)(const ::std::exception&, PyObject*)) {
+                PYPTR_INCREF(pytype);
+                exception_mapping m = { pytype, to_cpp, to_python };
+                ::std::lock_guard<free_threaded_mutex> guard(_lock);
+                _mappings.push_back(m);
+            }
+
+            // Later registrations take precedence. An exact type match is
+            // preferred over a subclass match. Returns nullptr if nothing
+            // converts exc_type to C++.
+            exception_mapping::to_cpp_function find(PyObject *exc_type) const {
+                ::std::lock_guard<free_threaded_mutex> guard(_lock);
+                for (auto it = _mappings.rbegin(); it != _mappings.rend(); ++it) {
+                    if (it->to_cpp != nullptr && it->pytype == exc_type) {
+                        return it->to_cpp;
+                    }
+                }
+                for (auto it = _mappings.rbegin(); it != _mappings.rend(); ++it) {
+                    if (it->to_cpp != nullptr && PyErr_GivenExceptionMatches(exc_type, it->pytype)) {
+                        return it->to_cpp;
+                    }
+                }
+                return nullptr;
+            }
+
+            void set_pyerr(const ::std::exception& exc) const {
+                ::std::lock_guard<free_threaded_mutex> guard(_lock);
+                for (auto it = _mappings.rbegin(); it != _mappings.rend(); ++it) {
+                    if (it->to_python != nullptr && it->to_python(exc, it->pytype)) {
+                        return;
+                    }
+                }
+                PyErr_SetString(PyExc_Exception, exc.what());
+            }
+        };
+
+        inline void throw_pyerr() {
+            if (PyErr_Occurred()) {
+                PyObject *exc_type, *exc_value, *trace;
+                PyErr_Fetch(&exc_type, &exc_value, &trace);
+                py_ptr type(steal(exc_type)), value(steal(exc_value)), tb(steal(trace));
+                auto to_cpp = exception_registry::get().find(type);
+                if (to_cpp != nullptr) {
+                    to_cpp(type, value, tb);
+                }
+                throw error(type, value, tb);
+            }
+        }
+
+        // Raises a C++ exception caught at the boundary as a Python error.
+        inline void set_pyerr(const ::std::exception& exc) {
+            auto pyerr = dynamic_cast<const error*>(&exc);
+            if (pyerr != nullptr) {
+                pyerr->restore();
+            } else {
+                exception_registry::get().set_pyerr(exc);
+            }
+        }
+    }
+
+    // Maps a C++ exception type to a Python exception type in both
+    // directions. If T derives from python::error it is constructed from
+    // the exception objects; otherwise from the formatted message.
+    template<typename T>
+    void register_exception(PyObject *pytype) {
+        details::exception_registry::get().add(pytype,
+            details::exception_translator<T>::to_cpp,
+            details::exception_translator<T>::to_python);
+    }
+}
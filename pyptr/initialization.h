@@ -1,200 +1,303 @@
-#pragma once
-
-#include "py_ptr.h"
-#include "py_capsule.h"
-#include "strings.h"
-#include "dict.h"
-
-#include <map>
-
-namespace python {
-    class interpreter;
-
-    class gil {
-        friend class allow_threads;
-        PyGILState_STATE state;
-        bool held;
-        ::std::unique_ptr<interpreter> current;
-
-    public:
-        gil() {
-            state = PyGILState_Ensure();
-            held = true;
-        }
-
-        ~gil() {
-            if (held) {
-                PyGILState_Release(state);
-            }
-        }
-
-        interpreter& current_interpreter() {
-            if (!current) {
-                current = ::std::make_unique<interpreter>();
-            }
-            return *current;
-        }
-    };
-
-    class allow_threads {
-        gil& _current;
-    public:
-
-        allow_threads(gil& current) : _current(current) {
-            _current.held = false;
-            PyGILState_Release(_current.state);
-        }
-
-        ~allow_threads() {
-            _current.state = PyGILState_Ensure();
-            _current.held = true;
-        }
-    };
-    
-    class trace_callbacks {
-    public:
-        virtual ~trace_callbacks() { }
-
-        virtual void on_call(py_ptr frame) { }
-        virtual void on_exception(py_ptr frame, py_ptr exc_type, py_ptr exc_value, py_ptr traceback) { }
-        virtual void on_line(py_ptr frame, int lineno) { }
-        virtual void on_return(py_ptr rame, py_ptr return_value) { }
-        virtual void on_c_call(py_ptr frame, py_ptr function) { }
-        virtual void on_c_return(py_ptr frame, py_ptr function) { }
-        virtual void on_c_exception(py_ptr frame, py_ptr function) { }
-    };
-
-    class interpreter {
-        bool needFinalize;
-
-        void initialize() {
-            if (!Py_IsInitialized()) {
-                needFinalize = false;
-
-                try {
-                    Py_Initialize();
-                }
-                catch (...) {
-                    throw ::std::runtime_error("unable to initialize Python");
-                }
-                needFinalize = true;
-            }
-
-#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 4
-            PyEval_InitThreads();
-#endif
-
-            if (PySys_GetObject("__pyptr__") == nullptr) {
-                PySys_SetObject("__pyptr__", details::detach(py_dict<py_str, py_ptr>::empty()));
-            }
-        }
-
-    public:
-        inline interpreter() : needFinalize(false) {
-            initialize();
-        }
-        
-        inline interpreter(const std::wstring &home) : needFinalize(false) {
-            Py_SetPythonHome(const_cast<wchar_t*>(home.c_str()));
-            initialize();
-        }
-        
-        inline interpreter(const std::wstring &home, const std::wstring &path) : needFinalize(false) {
-            Py_SetPythonHome(const_cast<wchar_t*>(home.c_str()));
-            Py_SetPath(const_cast<wchar_t*>(path.c_str()));
-            initialize();
-        }
-
-        inline ~interpreter() {
-            if (needFinalize) {
-                Py_Finalize();
-            }
-        }
-
-        inline void set_trace(trace_callbacks *callbacks) {
-            if (callbacks != nullptr) {
-                py_capsule<trace_callbacks> ptr(callbacks, false);
-                PyEval_SetTrace(reinterpret_cast<Py_tracefunc>(trace_callback), ptr);
-            } else {
-                PyEval_SetTrace(nullptr, nullptr);
-            }
-        }
-
-        inline void set_profile(trace_callbacks *callbacks) {
-            if (callbacks != nullptr) {
-                py_capsule<trace_callbacks> ptr(callbacks, false);
-                PyEval_SetProfile(reinterpret_cast<Py_tracefunc>(trace_callback), ptr);
-            } else {
-                PyEval_SetProfile(nullptr, nullptr);
-            }
-        }
-
-        template<typename Maker>
-        auto get_or_make_static_ptr() -> decltype((Maker())()) {
-            py_str key(typeid(Maker).name());
-            py_dict<py_str, py_ptr> statics(borrow(PySys_GetObject("__pyptr__")));
-            auto res = statics.get(key);
-            if (res == nullptr) {
-                statics[key] = res = Maker()();
-            }
-            return res.detach();
-        }
-
-        inline py_list<py_str> path() {
-            return borrow(PySys_GetObject("path"));
-        }
-
-        inline py_dict<py_str, py_ptr> modules() {
-            return borrow(PyImport_GetModuleDict());
-        }
-
-        inline py_ptr import(py_str name) {
-            return steal(PyImport_Import(name));
-        }
-
-    private:
-        // interpreter is immovable
-        interpreter(const interpreter&);
-        // interpreter is immovable
-        interpreter(interpreter&&);
-
-        static int trace_callback(PyObject *capsule, PyObject *frame, int what, PyObject *arg) {
-            auto callbacks = *py_capsule<trace_callbacks>(capsule);
-            if (callbacks == nullptr) {
-                return -1;
-            }
-            try {
-                py_ptr f = borrow(frame);
-                switch (what) {
-                case PyTrace_CALL:
-                    callbacks->on_call(f);
-                    break;
-                case PyTrace_EXCEPTION: {
-                    py_tuple<py_ptr, py_ptr, py_ptr> exc_info = borrow(arg);
-                    callbacks->on_exception(f, exc_info.get<0>(), exc_info.get<1>(), exc_info.get<2>());
-                    break;
-                }
-                case PyTrace_LINE:
-                    callbacks->on_line(f, getattr<py_int>(f, py_str("f_lineno")));
-                    break;
-                case PyTrace_RETURN:
-                    callbacks->on_return(f, borrow(arg));
-                    break;
-                case PyTrace_C_CALL:
-                    callbacks->on_c_call(f, borrow(arg));
-                    break;
-                case PyTrace_C_RETURN:
-                    callbacks->on_c_return(f, borrow(arg));
-                    break;
-                case PyTrace_C_EXCEPTION:
-                    callbacks->on_c_exception(f, borrow(arg));
-                    break;
-                }
-            } catch(std::exception exc) {
-                PyErr_SetString(PyExc_RuntimeError, exc.what());
-                return -1;
-            }
-            return 0;
-        }
-    };
-}
+#pragma once
+
+#include "py_ptr.h"
+#include "py_capsule.h"
+#include "strings.h"
+#include "interned.h"
+#include "interpreter_state.h"
+#include "dict.h"
+#include "telemetry.h"
+
+#include <map>
+
+namespace python {
+    class interpreter;
+
+    // Holds the GIL for its lifetime. Only the outermost gil on a thread
+    // calls PyGILState_Ensure; nested ones adjust a thread-local count.
+    class gil {
+        PyGILState_STATE _state;
+        bool _acquired;
+        unsigned _outer_depth;
+
+#ifdef pyptr_GIL_PROFILE
+        void acquire(telemetry::gil_site& site) {
+#else
+        void acquire() {
+#endif
+            auto& t = details::gil_tls();
+            if (t.held) {
+                ++t.depth;
+                return;
+            }
+#ifdef pyptr_GIL_PROFILE
+            auto start = telemetry::clock::now();
+#endif
+            _state = PyGILState_Ensure();
+#ifdef pyptr_GIL_PROFILE
+            telemetry::details::gil_acquired(site, start);
+#endif
+            _acquired = true;
+            _outer_depth = t.depth;
+            t.held = true;
+            t.depth = 1;
+        }
+
+    public:
+        // Without pyptr_GIL_PROFILE the site is not looked up at all
+        gil() : _acquired(false), _outer_depth(0) {
+#ifdef pyptr_GIL_PROFILE
+            acquire(telemetry::gil_site::untagged());
+#else
+            acquire();
+#endif
+        }
+
+        // Attributes wait and hold times to site under pyptr_GIL_PROFILE.
+        // Usually declared through PYPTR_GIL.
+#ifdef pyptr_GIL_PROFILE
+        explicit gil(telemetry::gil_site& site) : _acquired(false), _outer_depth(0) {
+            acquire(site);
+        }
+#else
+        explicit gil(telemetry::gil_site&) : _acquired(false), _outer_depth(0) {
+            acquire();
+        }
+#endif
+
+        ~gil() {
+            auto& t = details::gil_tls();
+            if (_acquired) {
+                t.depth = _outer_depth;
+                t.held = false;
+#ifdef pyptr_GIL_PROFILE
+                telemetry::details::gil_released();
+#endif
+                PyGILState_Release(_state);
+            } else {
+                --t.depth;
+            }
+        }
+
+        gil(const gil&) = delete;
+        gil& operator =(const gil&) = delete;
+
+        // Cheap enough to assert on in any function that touches objects.
+        static bool held() {
+            return details::gil_held();
+        }
+
+        interpreter& current_interpreter();
+    };
+
+    // In a free-threaded build, a gil scope only attaches a thread state
+    // and takes no global lock, so threads run Python in parallel. This name
+    // says so at the call site; objects shared between threads still need
+    // a critical_section around compound operations.
+    typedef gil attach_thread;
+
+    // Releases the GIL for its lifetime, however deeply the enclosing gil
+    // scopes are nested, and reacquires it on the same thread state.
+    class allow_threads {
+        PyThreadState *_saved;
+        details::gil_thread_state _outer;
+#ifdef pyptr_GIL_PROFILE
+        telemetry::gil_site *_site;
+#endif
+
+    public:
+        allow_threads() : _outer(details::gil_tls()) {
+            auto& t = details::gil_tls();
+            t.held = false;
+            t.depth = 0;
+#ifdef pyptr_GIL_PROFILE
+            _site = telemetry::details::gil_released();
+#endif
+            _saved = PyEval_SaveThread();
+        }
+
+        explicit allow_threads(gil&) : allow_threads() { }
+
+        ~allow_threads() {
+#ifdef pyptr_GIL_PROFILE
+            auto start = telemetry::clock::now();
+#endif
+            PyEval_RestoreThread(_saved);
+#ifdef pyptr_GIL_PROFILE
+            if (_site != nullptr) {
+                telemetry::details::gil_acquired(*_site, start);
+            }
+#endif
+            details::gil_tls() = _outer;
+        }
+
+        allow_threads(const allow_threads&) = delete;
+        allow_threads& operator =(const allow_threads&) = delete;
+    };
+    
+    class trace_callbacks {
+    public:
+        virtual ~trace_callbacks() { }
+
+        virtual void on_call(py_ptr frame) { }
+        virtual void on_exception(py_ptr frame, py_ptr exc_type, py_ptr exc_value, py_ptr traceback) { }
+        virtual void on_line(py_ptr frame, int lineno) { }
+        virtual void on_return(py_ptr rame, py_ptr return_value) { }
+        virtual void on_c_call(py_ptr frame, py_ptr function) { }
+        virtual void on_c_return(py_ptr frame, py_ptr function) { }
+        virtual void on_c_exception(py_ptr frame, py_ptr function) { }
+    };
+
+    class interpreter {
+        bool needFinalize;
+
+        void initialize() {
+            if (!Py_IsInitialized()) {
+                needFinalize = false;
+
+                try {
+                    Py_Initialize();
+                }
+                catch (...) {
+                    throw ::std::runtime_error("unable to initialize Python");
+                }
+                needFinalize = true;
+            }
+
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 4
+            PyEval_InitThreads();
+#endif
+
+            if (PySys_GetObject("__pyptr__") == nullptr) {
+                PySys_SetObject("__pyptr__", details::detach(py_dict<py_str, py_ptr>::empty()));
+            }
+            if (needFinalize) {
+                details::interpreter_state::get().owner = this;
+            }
+        }
+
+    public:
+        inline interpreter() : needFinalize(false) {
+            initialize();
+        }
+        
+        inline interpreter(const std::wstring &home) : needFinalize(false) {
+            Py_SetPythonHome(const_cast<wchar_t*>(home.c_str()));
+            initialize();
+        }
+        
+        inline interpreter(const std::wstring &home, const std::wstring &path) : needFinalize(false) {
+            Py_SetPythonHome(const_cast<wchar_t*>(home.c_str()));
+            Py_SetPath(const_cast<wchar_t*>(path.c_str()));
+            initialize();
+        }
+
+        inline ~interpreter() {
+            if (needFinalize) {
+                Py_Finalize();
+            }
+        }
+
+        inline void set_trace(trace_callbacks *callbacks) {
+            if (callbacks != nullptr) {
+                py_capsule<trace_callbacks> ptr(callbacks, false);
+                PyEval_SetTrace(reinterpret_cast<Py_tracefunc>(trace_callback), ptr);
+            } else {
+                PyEval_SetTrace(nullptr, nullptr);
+            }
+        }
+
+        inline void set_profile(trace_callbacks *callbacks) {
+            if (callbacks != nullptr) {
+                py_capsule<trace_callbacks> ptr(callbacks, false);
+                PyEval_SetProfile(reinterpret_cast<Py_tracefunc>(trace_callback), ptr);
+            } else {
+                PyEval_SetProfile(nullptr, nullptr);
+            }
+        }
+
+        // The interpreter object for the calling thread's interpreter. If
+        // pyptr did not start Python, one that never finalizes is created
+        // and kept with the interpreter's statics.
+        static interpreter& current() {
+            auto& state = details::interpreter_state::get();
+            if (state.owner == nullptr) {
+                state.owner = &state.native<interpreter>();
+            }
+            return *state.owner;
+        }
+
+        template<typename Maker>
+        auto get_or_make_static_ptr() -> decltype((Maker())()) {
+            auto& state = details::interpreter_state::get();
+            auto id = details::slot_id<Maker>();
+            auto res = state.object(id);
+            if (res == nullptr) {
+                state.set_object(id, details::detach(Maker()()));
+                res = state.object(id);
+            }
+            return borrow(res);
+        }
+
+        inline py_list<py_str> path() {
+            return borrow(PySys_GetObject("path"));
+        }
+
+        inline py_dict<py_str, py_ptr> modules() {
+            return borrow(PyImport_GetModuleDict());
+        }
+
+        inline py_ptr import(py_str name) {
+            return steal(PyImport_Import(name));
+        }
+
+    private:
+        // interpreter is immovable
+        interpreter(const interpreter&);
+        // interpreter is immovable
+        interpreter(interpreter&&);
+
+        static int trace_callback(PyObject *capsule, PyObject *frame, int what, PyObject *arg) {
+            auto callbacks = *py_capsule<trace_callbacks>(capsule);
+            if (callbacks == nullptr) {
+                return -1;
+            }
+            try {
+                py_ptr f = borrow(frame);
+                switch (what) {
+                case PyTrace_CALL:
+                    callbacks->on_call(f);
+                    break;
+                case PyTrace_EXCEPTION: {
+                    py_tuple<py_ptr, py_ptr, py_ptr> exc_info = borrow(arg);
+                    callbacks->on_exception(f, exc_info.get<0>(), exc_info.get<1>(), exc_info.get<2>());
+                    break;
+                }
+                case PyTrace_LINE:
+                    callbacks->on_line(f, getattr<py_int>(f, PYPTR_STR("f_lineno")));
+                    break;
+                case PyTrace_RETURN:
+                    callbacks->on_return(f, borrow(arg));
+                    break;
+                case PyTrace_C_CALL:
+                    callbacks->on_c_call(f, borrow(arg));
+                    break;
+                case PyTrace_C_RETURN:
+                    callbacks->on_c_return(f, borrow(arg));
+                    break;
+                case PyTrace_C_EXCEPTION:
+                    callbacks->on_c_exception(f, borrow(arg));
+                    break;
+                }
+            } catch(const ::std::exception& exc) {
+                details::set_pyerr(exc);
+                return -1;
+            }
+            return 0;
+        }
+    };
+
+    inline interpreter& gil::current_interpreter() {
+        return interpreter::current();
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "py_ptr.h"
+#include "borrowed.h"
+#include "strings.h"
+#include "interpreter_state.h"
+
+#include <mutex>
+#include <unordered_map>
+
+//
+// PYPTR_STR("name") produces an interned str for a string literal, as a
+// const py_str& that is valid until the end of the full expression. It is
+// created on first use in each interpreter and cached at the call site, so
+// attribute and key lookups with it skip building and hashing a new string.
+//
+//     getattr(obj, PYPTR_STR("name"));
+//
+
+namespace python {
+    namespace details {
+        // Holds a reference to every string interned through PYPTR_STR in
+        // one interpreter, keyed by the literal's address so that each call
+        // site adds at most one however many threads refill their slots. It
+        // is released with the interpreter's state, and the generation bump
+        // tells every call site to intern again.
+        class interned_strings {
+            friend class interpreter_state;
+
+            ::std::unordered_map<const char*, PyObject*> _strings;
+            free_threaded_mutex _lock;
+
+            interned_strings() { }
+
+        public:
+            ~interned_strings() {
+                for (auto& s : _strings) {
+                    PYPTR_DECREF(s.second);
+                }
+            }
+
+            interned_strings(const interned_strings&) = delete;
+            interned_strings& operator =(const interned_strings&) = delete;
+
+            // Returns a borrowed reference, which lives as long as the
+            // interpreter's state
+            PyObject *intern(const char *text) {
+                ::std::lock_guard<free_threaded_mutex> guard(_lock);
+                auto it = _strings.find(text);
+                if (it != _strings.end()) {
+                    return it->second;
+                }
+#if PY_MAJOR_VERSION == 3
+                auto s = PyUnicode_InternFromString(text);
+#else
+                auto s = PyString_InternFromString(text);
+#endif
+                if (s == nullptr) {
+                    throw_pyerr();
+                }
+                _strings.emplace(text, s);
+                return s;
+            }
+        };
+
+        struct literal_slot {
+            PyInterpreterState *interp;
+            uint64_t generation;
+            PyObject *value;
+        };
+
+        inline PyObject *get_literal(literal_slot& slot, const char *text) {
+            auto interp = current_interp();
+            auto gen = interpreter_state::generation().load(::std::memory_order_acquire);
+            if (slot.value == nullptr || slot.interp != interp || slot.generation != gen) {
+                slot.value = interpreter_state::get().native<interned_strings>().intern(text);
+                slot.interp = interp;
+                slot.generation = gen;
+            }
+            return slot.value;
+        }
+    }
+}
+
+#define PYPTR_STR(TEXT) ::python::borrowed<::python::py_str>([]() -> PyObject* { \
+        static thread_local ::python::details::literal_slot slot = { nullptr, 0, nullptr }; \
+        return ::python::details::get_literal(slot, TEXT); \
+    }(), ::python::unchecked).get()
@@ -0,0 +1,246 @@
+#pragma once
+
+#include "py_ptr.h"
+#include "py_capsule.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+namespace python {
+    class interpreter;
+
+    namespace details {
+        inline PyInterpreterState *current_interp() {
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 9
+            return PyInterpreterState_Get();
+#else
+            return PyThreadState_GET()->interp;
+#endif
+        }
+
+        inline size_t next_slot_id() {
+            static ::std::atomic<size_t> next(0);
+            return next++;
+        }
+
+        // A small index for Tag, assigned on first use and the same in
+        // every interpreter.
+        template<typename Tag>
+        inline size_t slot_id() {
+            static const size_t id = next_slot_id();
+            return id;
+        }
+
+        // The pyptr statics for one interpreter. Python objects and native
+        // objects are kept in slots indexed by slot_id<Tag>(), so once a
+        // thread has found the state, a lookup is a vector index.
+        //
+        // Each state is owned by a capsule in sys.__pyptr__ and is destroyed
+        // when its interpreter is finalized. Live states are also kept in a
+        // process-wide map, so threads never need to go through sys.
+        class interpreter_state {
+            struct native_slot {
+                void *value;
+                void (*destroy)(void*);
+            };
+
+            struct thread_cache {
+                PyInterpreterState *interp;
+                uint64_t generation;
+                interpreter_state *state;
+            };
+
+            struct registry {
+                ::std::mutex lock;
+                ::std::unordered_map<PyInterpreterState*, interpreter_state*> states;
+
+                static registry& get() {
+                    static registry instance;
+                    return instance;
+                }
+            };
+
+            PyInterpreterState *_interp;
+            ::std::vector<PyObject*> _objects;
+            ::std::vector<native_slot> _natives;
+            // Natives are destroyed in the reverse of their creation order
+            ::std::vector<size_t> _created;
+            mutable free_threaded_mutex _lock;
+
+            static thread_cache& cache() {
+                static thread_local thread_cache value = { nullptr, 0, nullptr };
+                return value;
+            }
+
+            explicit interpreter_state(PyInterpreterState *interp) : _interp(interp), owner(nullptr) { }
+
+            // Inserts value under name unless another thread got there first,
+            // and returns a new reference to whichever value is stored.
+            static PyObject *set_default(PyObject *dict, const char *name, PyObject *value) {
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 13
+                py_ptr key(steal(PyUnicode_InternFromString(name)));
+                PyObject *result;
+                if (!key || PyDict_SetDefaultRef(dict, key, value, &result) < 0) {
+                    throw_pyerr();
+                }
+                return result;
+#elif PY_MAJOR_VERSION == 3
+                py_ptr key(steal(PyUnicode_InternFromString(name)));
+                auto result = key ? PyDict_SetDefault(dict, key, value) : nullptr;
+                if (result == nullptr) {
+                    throw_pyerr();
+                }
+                PYPTR_INCREF(result);
+                return result;
+#else
+                auto result = PyDict_GetItemString(dict, name);
+                if (result == nullptr) {
+                    if (PyDict_SetItemString(dict, name, value) != 0) {
+                        throw_pyerr();
+                    }
+                    result = value;
+                }
+                PYPTR_INCREF(result);
+                return result;
+#endif
+            }
+
+            // Threads may race to create the state. Only the first capsule
+            // stored in sys.__pyptr__ is kept; a losing thread's state is
+            // released with its capsule before anything can use it.
+            static interpreter_state *create(PyInterpreterState *interp) {
+                py_ptr sys(steal(PyImport_ImportModule("sys")));
+                py_ptr fresh(steal(PyDict_New()));
+                if (!sys || !fresh) {
+                    throw_pyerr();
+                }
+                py_ptr statics(steal(set_default(PyModule_GetDict(sys), "__pyptr__", fresh)));
+
+                py_capsule<interpreter_state> caps(new interpreter_state(interp));
+                py_capsule<interpreter_state> stored(steal(set_default(statics, typeid(interpreter_state).name(), caps)));
+                if (*stored == nullptr) {
+                    PyErr_SetString(PyExc_RuntimeError, "sys.__pyptr__ holds an unexpected object");
+                    throw_pyerr();
+                }
+
+                auto& reg = registry::get();
+                ::std::lock_guard<::std::mutex> guard(reg.lock);
+                reg.states[interp] = *stored;
+                return *stored;
+            }
+
+        public:
+            // The interpreter object that started this interpreter, or the
+            // one created by interpreter::current() if pyptr did not.
+            interpreter *owner;
+
+            ~interpreter_state() {
+                {
+                    auto& reg = registry::get();
+                    ::std::lock_guard<::std::mutex> guard(reg.lock);
+                    auto it = reg.states.find(_interp);
+                    if (it != reg.states.end() && it->second == this) {
+                        reg.states.erase(it);
+                    }
+                }
+                ++generation();
+
+                for (auto i = _created.rbegin(); i != _created.rend(); ++i) {
+                    _natives[*i].destroy(_natives[*i].value);
+                }
+                for (auto obj : _objects) {
+                    PYPTR_XDECREF(obj);
+                }
+            }
+
+            interpreter_state(const interpreter_state&) = delete;
+            interpreter_state& operator =(const interpreter_state&) = delete;
+
+            // Bumped whenever a state is destroyed, which invalidates every
+            // pointer cached from one.
+            static ::std::atomic<uint64_t>& generation() {
+                static ::std::atomic<uint64_t> value(1);
+                return value;
+            }
+
+            // The state for the calling thread's interpreter, or nullptr if
+            // it has not been created.
+            static interpreter_state *current() {
+                PYPTR_ASSERT_GIL();
+                auto& c = cache();
+                auto interp = current_interp();
+                auto gen = generation().load(::std::memory_order_acquire);
+                if (c.state != nullptr && c.interp == interp && c.generation == gen) {
+                    return c.state;
+                }
+
+                interpreter_state *state = nullptr;
+                {
+                    auto& reg = registry::get();
+                    ::std::lock_guard<::std::mutex> guard(reg.lock);
+                    auto it = reg.states.find(interp);
+                    if (it != reg.states.end()) {
+                        state = it->second;
+                    }
+                }
+                if (state != nullptr) {
+                    c.interp = interp;
+                    c.generation = gen;
+                    c.state = state;
+                }
+                return state;
+            }
+
+            static interpreter_state& get() {
+                auto state = current();
+                return state != nullptr ? *state : *create(current_interp());
+            }
+
+            // Returns a borrowed reference, or nullptr if the slot is empty
+            PyObject *object(size_t id) const {
+                ::std::lock_guard<free_threaded_mutex> guard(_lock);
+                return id < _objects.size() ? _objects[id] : nullptr;
+            }
+
+            // Steals a reference to value, releasing the previous one
+            void set_object(size_t id, PyObject *value) {
+                ::std::unique_lock<free_threaded_mutex> guard(_lock);
+                if (id >= _objects.size()) {
+                    _objects.resize(id + 1, nullptr);
+                }
+                auto previous = _objects[id];
+                _objects[id] = value;
+                guard.unlock();
+                PYPTR_XDECREF(previous);
+            }
+
+            template<typename T>
+            T *find_native() const {
+                auto id = slot_id<T>();
+                ::std::lock_guard<free_threaded_mutex> guard(_lock);
+                return id < _natives.size() ? static_cast<T*>(_natives[id].value) : nullptr;
+            }
+
+            template<typename T>
+            T& native() {
+                auto id = slot_id<T>();
+                ::std::lock_guard<free_threaded_mutex> guard(_lock);
+                if (id >= _natives.size()) {
+                    native_slot empty = { nullptr, nullptr };
+                    _natives.resize(id + 1, empty);
+                }
+                auto& slot = _natives[id];
+                if (slot.value == nullptr) {
+                    slot.value = new T();
+                    slot.destroy = [](void *value) { delete static_cast<T*>(value); };
+                    _created.push_back(id);
+                }
+                return *static_cast<T*>(slot.value);
+            }
+        };
+    }
+}
@@ -1,125 +1,169 @@
-#pragma once
-#include "py_ptr.h"
-#include <list>
-#include <type_traits>
-#include <vector>
-
-namespace python {
-    namespace details {
-        template<typename T>
-        struct list_item_proxy {
-        private:
-            PyObject *list;
-            Py_ssize_t index;
-        public:
-            list_item_proxy(PyObject *list, Py_ssize_t index) : list(list), index(index) { }
-
-            list_item_proxy& operator=(T&& value) {
-                if (PyList_SetItem(list, index, typename pyptr_type<T>::type(value).detach()) != 0) {
-                    details::throw_pyerr();
-                }
-                return *this;
-            }
-
-            operator T() const {
-                return typename pyptr_type<T>::type(borrow(PyList_GetItem(list, index)));
-            }
-        };
-    }
-
-    template<typename T>
-    struct py_list : public details::py_ptrbase<py_list<T>> {
-        PYPTR_CONSTRUCTORS(py_list);
-        PYPTR_ITERABLE(T);
-
-        template<typename Container>
-        py_list(const Container& cont) {
-            static_assert(::std::is_same<typename details::pyptr_type<Container>::type, py_list<typename details::pyptr_type<T>::type>>::value, "invalid container type");
-            ptr = PyList_New(0);
-            for (auto it = ::std::begin(cont); it != ::std::end(cont); ++it) {
-                if (PyList_Append(ptr, details::detach<decltype(*it), T>(*it)) != 0) {
-                    details::throw_pyerr();
-                }
-            }
-        }
-
-        template<typename Iter>
-        py_list(Iter begin, Iter end) {
-            ptr = PyList_New(0);
-            if (ptr == nullptr) details::throw_pyerr();
-            for(auto it = begin; it != end; ++it) {
-                if (PyList_Append(ptr, details::detach<decltype(*it), T>(*it)) != 0) {
-                    details::throw_pyerr();
-                }
-            }
-        }
-
-        details::list_item_proxy<T> operator[](ssize_t index) {
-            return details::list_item_proxy<T>(*this, index);
-        }
-
-        void append(const T& value) {
-            if (PyList_Append(ptr, details::detach(value)) != 0) {
-                details::throw_pyerr();
-            }
-        }
-
-        void del(ssize_t index) {
-            if (PyObject_DelItem(ptr, py_int(index)) != 0) {
-                details::throw_pyerr();
-            }
-        }
-
-        size_t size() const {
-            Py_ssize_t res = PyObject_Size(ptr);
-            if (res < 0) {
-                details::throw_pyerr();
-                return 0;
-            }
-            return static_cast<size_t>(res);
-        }
-
-        static inline py_list<T> empty() {
-            return steal(PyList_New(0));
-        }
-    };
-
-    PYPTR_TEMPLATE_CHECKPTR(py_list<T>, PyList_Type, PyList_Check(ptr), typename T);
-
-    namespace details {
-        template<typename T>
-        struct pyptr_type<::std::vector<T>> { typedef py_list<typename pyptr_type<T>::type> type; };
-
-        template<typename T>
-        struct pyptr_type<::std::list<T>> { typedef py_list<typename pyptr_type<T>::type> type; };
-    }
-
-    inline py_list<py_ptr> make_py_list() {
-        return steal(PyList_New(0));
-    }
-
-    template<typename T>
-    py_list<T> make_py_list(T item0) {
-        py_list<T> result = steal(PyList_New(1));
-        PyList_SET_ITEM((PyObject*)result, 0, item0.detach());
-        return result;
-    }
-
-    template<typename T>
-    py_list<T> make_py_list(T item0, T item1) {
-        py_list<T> result = steal(PyList_New(2));
-        PyList_SET_ITEM((PyObject*)result, 0, item0.detach());
-        PyList_SET_ITEM((PyObject*)result, 1, item1.detach());
-        return result;
-    }
-
-    template<typename T>
-    py_list<T> make_py_list(T item0, T item1, T item2) {
-        py_list<T> result = steal(PyList_New(3));
-        PyList_SET_ITEM((PyObject*)result, 0, item0.detach());
-        PyList_SET_ITEM((PyObject*)result, 1, item1.detach());
-        PyList_SET_ITEM((PyObject*)result, 2, item2.detach());
-        return result;
-    }
-}
-
+#pragma once
+#include "py_ptr.h"
+#include "borrowed.h"
+#include "converters.h"
+#include "bulk.h"
+#include <iterator>
+#include <list>
+#include <type_traits>
+#include <vector>
+
+namespace python {
+    namespace details {
+        template<typename T>
+        struct list_item_proxy {
+        private:
+            PyObject *list;
+            Py_ssize_t index;
+        public:
+            list_item_proxy(PyObject *list, Py_ssize_t index) : list(list), index(index) { }
+
+            list_item_proxy& operator=(T&& value) {
+                if (PyList_SetItem(list, index, typename pyptr_type<T>::type(value).detach()) != 0) {
+                    details::throw_pyerr();
+                }
+                return *this;
+            }
+
+            operator T() const {
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 13
+                return typename pyptr_type<T>::type(steal(PyList_GetItemRef(list, index)));
+#else
+                return typename pyptr_type<T>::type(borrow(PyList_GetItem(list, index)));
+#endif
+            }
+        };
+    }
+
+    template<typename T>
+    struct py_list : public details::py_ptrbase<py_list<T>> {
+        PYPTR_CONSTRUCTORS(py_list);
+        PYPTR_ITERABLE(T);
+
+    private:
+        // When the length is known up front the list is allocated once and
+        // filled in place.
+        template<typename Iter>
+        void fill(Iter begin, Iter end, ::std::forward_iterator_tag) {
+            auto size = static_cast<Py_ssize_t>(::std::distance(begin, end));
+            ptr = PyList_New(size);
+            if (ptr == nullptr) details::throw_pyerr();
+            Py_ssize_t i = 0;
+            for (auto it = begin; it != end; ++it, ++i) {
+                auto item = details::box_item<decltype(*it), T>(*it);
+                PyList_SET_ITEM(ptr, i, item);
+            }
+        }
+
+        template<typename Iter>
+        void fill(Iter begin, Iter end, ::std::input_iterator_tag) {
+            ptr = PyList_New(0);
+            if (ptr == nullptr) details::throw_pyerr();
+            for (auto it = begin; it != end; ++it) {
+                if (PyList_Append(ptr, py_ptr(steal(details::box_item<decltype(*it), T>(*it)))) != 0) {
+                    details::throw_pyerr();
+                }
+            }
+        }
+
+    public:
+        template<typename Container>
+        py_list(const Container& cont) {
+            static_assert(::std::is_same<typename details::pyptr_type<Container>::type, py_list<typename details::pyptr_type<T>::type>>::value, "invalid container type");
+            fill(::std::begin(cont), ::std::end(cont), typename ::std::iterator_traits<decltype(::std::begin(cont))>::iterator_category());
+        }
+
+        template<typename Iter>
+        py_list(Iter begin, Iter end) {
+            fill(begin, end, typename ::std::iterator_traits<Iter>::iterator_category());
+        }
+
+        details::list_item_proxy<T> operator[](ssize_t index) {
+            return details::list_item_proxy<T>(*this, index);
+        }
+
+        borrowed<T> get_borrowed(Py_ssize_t index) const {
+            auto item = PyList_GetItem(ptr, index);
+            if (item == nullptr) details::throw_pyerr();
+            return borrowed<T>(item);
+        }
+
+        details::borrowed_range<T, details::list_access> borrowed_items() const {
+            return ptr;
+        }
+
+        void append(const T& value) {
+            if (PyList_Append(ptr, details::detach(value)) != 0) {
+                details::throw_pyerr();
+            }
+        }
+
+        void del(ssize_t index) {
+            if (PyObject_DelItem(ptr, py_int(index)) != 0) {
+                details::throw_pyerr();
+            }
+        }
+
+        size_t size() const {
+            Py_ssize_t res = PyObject_Size(ptr);
+            if (res < 0) {
+                details::throw_pyerr();
+                return 0;
+            }
+            return static_cast<size_t>(res);
+        }
+
+        // Converts every item in one pass. The list is locked while it is
+        // read, so the result is a consistent snapshot.
+        template<typename TOut = T>
+        ::std::vector<TOut> to_vector() const {
+            critical_section lock(ptr);
+            ::std::vector<TOut> result(static_cast<size_t>(PyList_GET_SIZE(ptr)));
+            details::bulk_unboxer<TOut>::unbox(ptr, result.size(), result.begin());
+            return result;
+        }
+
+        static inline py_list<T> empty() {
+            return steal(PyList_New(0));
+        }
+    };
+
+    PYPTR_TEMPLATE_CHECKPTR(py_list<T>, PyList_Type, PyList_Check(ptr), typename T);
+
+    namespace details {
+        template<typename T>
+        struct pyptr_type<::std::vector<T>> { typedef py_list<typename pyptr_type<T>::type> type; };
+
+        template<typename T>
+        struct pyptr_type<::std::list<T>> { typedef py_list<typename pyptr_type<T>::type> type; };
+    }
+
+    inline py_list<py_ptr> make_py_list() {
+        return steal(PyList_New(0));
+    }
+
+    template<typename T>
+    py_list<T> make_py_list(T item0) {
+        py_list<T> result = steal(PyList_New(1));
+        PyList_SET_ITEM((PyObject*)result, 0, item0.detach());
+        return result;
+    }
+
+    template<typename T>
+    py_list<T> make_py_list(T item0, T item1) {
+        py_list<T> result = steal(PyList_New(2));
+        PyList_SET_ITEM((PyObject*)result, 0, item0.detach());
+        PyList_SET_ITEM((PyObject*)result, 1, item1.detach());
+        return result;
+    }
+
+    template<typename T>
+    py_list<T> make_py_list(T item0, T item1, T item2) {
+        py_list<T> result = steal(PyList_New(3));
+        PyList_SET_ITEM((PyObject*)result, 0, item0.detach());
+        PyList_SET_ITEM((PyObject*)result, 1, item1.detach());
+        PyList_SET_ITEM((PyObject*)result, 2, item2.detach());
+        return result;
+    }
+}
+
@@ -0,0 +1,269 @@
+#pragma once
+
+#include "py_ptr.h"
+#include "py_capsule.h"
+#include "callback.h"
+#include "converters.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace python {
+    namespace details {
+        template<typename... Ts> struct accepts_args;
+
+        template<>
+        struct accepts_args<> {
+            static const bool by_type = true;
+            static inline bool check(PyObject *const *args) { return true; }
+        };
+
+        template<typename T0, typename... Ts>
+        struct accepts_args<T0, Ts...> {
+            static const bool by_type = !check_depends_on_value<T0>::value && accepts_args<Ts...>::by_type;
+
+            static inline bool check(PyObject *const *args) {
+                return arg_converter<T0>::check(args[0]) && accepts_args<Ts...>::check(args + 1);
+            }
+        };
+
+        struct overload_base {
+            virtual ~overload_base() { }
+
+            virtual Py_ssize_t arg_count() const = 0;
+            virtual bool accepts(PyObject *const *args) const = 0;
+            // Whether accepts() depends only on the argument types
+            virtual bool by_type() const = 0;
+            virtual PyObject *invoke(PyObject *const *args) const = 0;
+        };
+
+        template<typename TResult, typename TInstance, typename... Ts>
+        struct overload : public overload_base {
+            typedef function_type<TResult, TInstance, Ts...> Function;
+            typedef typename ::std::conditional<
+                ::std::is_void<TInstance>::value,
+                accepts_args<Ts...>,
+                accepts_args<py_object<TInstance>, Ts...>
+            >::type Accepts;
+
+            typename Function::type func;
+
+            overload(typename Function::type func) : func(func) { }
+
+            Py_ssize_t arg_count() const {
+                return static_cast<Py_ssize_t>(Function::arg_count);
+            }
+
+            bool accepts(PyObject *const *args) const {
+                return Accepts::check(args);
+            }
+
+            bool by_type() const {
+                return Accepts::by_type;
+            }
+
+            PyObject *invoke(PyObject *const *args) const {
+                return details::detach(Function::call(func, args));
+            }
+        };
+
+        template<typename TResult, typename TInstance, typename... Ts>
+        ::std::unique_ptr<overload_base> make_overload(TResult (TInstance::*fn)(Ts...)) {
+            return ::std::unique_ptr<overload_base>(new overload<TResult, TInstance, Ts...>(fn));
+        }
+
+        template<typename TResult, typename... Ts>
+        ::std::unique_ptr<overload_base> make_overload(TResult (*fn)(Ts...)) {
+            return ::std::unique_ptr<overload_base>(new overload<TResult, void, Ts...>(fn));
+        }
+
+        // Remembers which overload matched a tuple of argument types, so
+        // repeated calls with the same types skip overload resolution. The
+        // cached types are referenced so their addresses cannot be reused.
+        // Without the GIL, entries are read and replaced under a lock.
+        struct overload_cache {
+            static const size_t max_arity = 6;
+            static const size_t capacity = 8;
+
+            struct entry {
+                Py_ssize_t nargs;
+                PyTypeObject *types[max_arity];
+                size_t index;
+            };
+
+            entry entries[capacity];
+            size_t next;
+            mutable free_threaded_mutex lock;
+
+            overload_cache() : next(0) {
+                for (auto& e : entries) {
+                    e.nargs = -1;
+                }
+            }
+
+            ~overload_cache() {
+                for (auto& e : entries) {
+                    for (Py_ssize_t i = 0; i < e.nargs; ++i) {
+                        PYPTR_DECREF(e.types[i]);
+                    }
+                }
+            }
+
+            bool find(PyObject *const *args, Py_ssize_t nargs, size_t& index) const {
+                ::std::lock_guard<free_threaded_mutex> guard(lock);
+                for (auto& e : entries) {
+                    if (e.nargs != nargs) {
+                        continue;
+                    }
+                    Py_ssize_t i = 0;
+                    while (i < nargs && e.types[i] == Py_TYPE(args[i])) {
+                        ++i;
+                    }
+                    if (i == nargs) {
+                        index = e.index;
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            void add(PyObject *const *args, Py_ssize_t nargs, size_t index) {
+                if (nargs > static_cast<Py_ssize_t>(max_arity)) {
+                    return;
+                }
+                // The replaced types are released after unlocking, since
+                // freeing a type may run Python code
+                PyTypeObject *replaced[max_arity];
+                Py_ssize_t replacedCount;
+                {
+                    ::std::lock_guard<free_threaded_mutex> guard(lock);
+                    auto& e = entries[next];
+                    next = (next + 1) % capacity;
+                    replacedCount = e.nargs > 0 ? e.nargs : 0;
+                    for (Py_ssize_t i = 0; i < replacedCount; ++i) {
+                        replaced[i] = e.types[i];
+                    }
+                    for (Py_ssize_t i = 0; i < nargs; ++i) {
+                        e.types[i] = Py_TYPE(args[i]);
+                        PYPTR_INCREF(e.types[i]);
+                    }
+                    e.index = index;
+                    e.nargs = nargs;
+                }
+                for (Py_ssize_t i = 0; i < replacedCount; ++i) {
+                    PYPTR_DECREF(replaced[i]);
+                }
+            }
+        };
+
+        struct overload_set {
+            PyMethodDef md;
+            ::std::string name;
+            ::std::vector<::std::unique_ptr<overload_base>> overloads;
+            overload_cache cache;
+
+            PyObject *dispatch(PyObject *const *args, Py_ssize_t nargs) {
+                size_t cached;
+                if (cache.find(args, nargs, cached)) {
+                    return overloads[cached]->invoke(args);
+                }
+                // The choice is only cached if every overload considered
+                // was decided by the argument types alone
+                bool by_type = true;
+                for (size_t i = 0; i < overloads.size(); ++i) {
+                    auto& candidate = overloads[i];
+                    if (candidate->arg_count() != nargs) {
+                        continue;
+                    }
+                    by_type = by_type && candidate->by_type();
+                    if (candidate->accepts(args)) {
+                        if (by_type) {
+                            cache.add(args, nargs, i);
+                        }
+                        return candidate->invoke(args);
+                    }
+                }
+                if (!PyErr_Occurred()) {
+                    PyErr_SetString(PyExc_TypeError, "no overload matches the given arguments");
+                }
+                return nullptr;
+            }
+        };
+    }
+
+    // A single Python callable that dispatches to one of several C++
+    // functions. Overloads are tried in the order they were given and the
+    // first whose parameters accept the argument types is called.
+    struct py_overloads : public details::py_ptrbase<py_overloads> {
+        PYPTR_CONSTRUCTORS(py_overloads);
+
+    private:
+        static details::overload_set *get_set(PyObject *self) {
+#if PY_MAJOR_VERSION == 2 && PY_MINOR_VERSION <= 6
+            return *py_capsule<details::overload_set>(borrow(self));
+#else
+            return reinterpret_cast<details::overload_set*>(
+                PyCapsule_GetPointer(self, typeid(py_capsule<details::overload_set>).name())
+            );
+#endif
+        }
+
+        static PyObject *called(PyObject *self, PyObject *args, PyObject *kwargs) {
+            auto set = get_set(self);
+            if (set == nullptr) {
+                return nullptr;
+            }
+            return set->dispatch(&PyTuple_GET_ITEM(args, 0), PyTuple_GET_SIZE(args));
+        }
+
+#ifdef pyptr_FASTCALL
+        static PyObject *called_fast(PyObject *self, PyObject *const *args, Py_ssize_t nargs) {
+            auto set = get_set(self);
+            if (set == nullptr) {
+                return nullptr;
+            }
+            return set->dispatch(args, nargs);
+        }
+#endif
+
+    public:
+        py_overloads(::std::vector<::std::unique_ptr<details::overload_base>> overloads) {
+            py_capsule<details::overload_set> caps(new details::overload_set());
+            caps->md.ml_name = "<overloads>";
+#ifdef pyptr_FASTCALL
+            caps->md.ml_meth = reinterpret_cast<PyCFunction>(called_fast);
+            caps->md.ml_flags = METH_FASTCALL;
+#else
+            caps->md.ml_meth = reinterpret_cast<PyCFunction>(called);
+            caps->md.ml_flags = METH_VARARGS;
+#endif
+            caps->md.ml_doc = nullptr;
+            caps->overloads = ::std::move(overloads);
+
+            ptr = PyCFunction_New(&caps->md, caps);
+            if (ptr == nullptr) details::throw_pyerr();
+        }
+
+        // Sets the __name__ of the function object
+        void set_name(const char *name) {
+            auto set = get_set(PyCFunction_GET_SELF(ptr));
+            if (set == nullptr) details::throw_pyerr();
+            set->name = name;
+            set->md.ml_name = set->name.c_str();
+        }
+    };
+
+    PYPTR_SIMPLE_CHECKPTR(py_overloads, "C function", PyCFunction_Check(ptr) != 0);
+
+    template<typename... TFunctions>
+    py_overloads overloads(TFunctions... fns) {
+        ::std::vector<::std::unique_ptr<details::overload_base>> result;
+        result.reserve(sizeof...(TFunctions));
+        int unused[] = { 0, (result.push_back(details::make_overload(fns)), 0)... };
+        (void)unused;
+        return py_overloads(::std::move(result));
+    }
+}
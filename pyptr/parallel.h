@@ -0,0 +1,310 @@
+#pragma once
+
+#include "py_ptr.h"
+#include "converters.h"
+#include "bulk.h"
+#include "list.h"
+#include "initialization.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+//
+// Data-parallel loops over Python sequences. The items are unboxed into
+// native storage while the GIL is held, the kernel runs on a shared
+// work-stealing pool with the GIL released, and (for parallel_transform)
+// the results are boxed into a new list once the GIL is reacquired.
+//
+//     auto doubled = parallel_transform<double>(values, [](double v) { return v * 2; });
+//
+
+namespace python {
+    struct parallel_options {
+        // Items per task. Zero picks a size from the length and the number
+        // of threads; cheap kernels over long sequences want larger chunks.
+        size_t chunk_size;
+
+        parallel_options() : chunk_size(0) { }
+        explicit parallel_options(size_t chunk_size) : chunk_size(chunk_size) { }
+    };
+
+    namespace details {
+        // A process-wide pool with one task queue per thread. Threads take
+        // from the front of their own queue and steal from the back of the
+        // others. The thread that submits a job works on it too, so jobs
+        // may be nested without deadlocking.
+        class work_stealing_pool {
+            struct job {
+                const ::std::function<void(size_t)> *body;
+                ::std::atomic<size_t> remaining;
+                ::std::atomic<bool> failed;
+                ::std::exception_ptr failure;
+                ::std::mutex lock;
+                ::std::condition_variable done;
+
+                job(const ::std::function<void(size_t)>& body, size_t count)
+                    : body(&body), remaining(count), failed(false) { }
+            };
+
+            struct task {
+                job *owner;
+                size_t chunk;
+            };
+
+            struct queue {
+                ::std::mutex lock;
+                ::std::deque<task> tasks;
+            };
+
+            ::std::vector<::std::unique_ptr<queue>> _queues;
+            ::std::vector<::std::thread> _threads;
+            ::std::mutex _idle_lock;
+            ::std::condition_variable _idle;
+            ::std::atomic<size_t> _queued;
+            bool _stopping;
+
+            bool take(size_t self, task& t) {
+                auto n = _queues.size();
+                for (size_t i = 0; i < n; ++i) {
+                    auto& q = *_queues[(self + i) % n];
+                    ::std::lock_guard<::std::mutex> guard(q.lock);
+                    if (q.tasks.empty()) {
+                        continue;
+                    }
+                    if (i == 0) {
+                        t = q.tasks.front();
+                        q.tasks.pop_front();
+                    } else {
+                        t = q.tasks.back();
+                        q.tasks.pop_back();
+                    }
+                    --_queued;
+                    return true;
+                }
+                return false;
+            }
+
+            static void execute(const task& t) {
+                auto& j = *t.owner;
+                if (!j.failed.load(::std::memory_order_relaxed)) {
+                    try {
+                        (*j.body)(t.chunk);
+                    } catch (...) {
+                        ::std::lock_guard<::std::mutex> guard(j.lock);
+                        if (!j.failure) {
+                            j.failure = ::std::current_exception();
+                        }
+                        j.failed = true;
+                    }
+                }
+                ::std::lock_guard<::std::mutex> guard(j.lock);
+                if (--j.remaining == 0) {
+                    j.done.notify_all();
+                }
+            }
+
+            void work(size_t self) {
+                task t;
+                for (;;) {
+                    if (take(self, t)) {
+                        execute(t);
+                        continue;
+                    }
+                    ::std::unique_lock<::std::mutex> l(_idle_lock);
+                    _idle.wait(l, [&] { return _stopping || _queued.load() > 0; });
+                    if (_stopping && _queued.load() == 0) {
+                        return;
+                    }
+                }
+            }
+
+            work_stealing_pool() : _queued(0), _stopping(false) {
+                auto count = ::std::thread::hardware_concurrency();
+                // The submitting thread makes up the last worker
+                auto threads = count > 1 ? count - 1 : 1;
+                for (size_t i = 0; i <= threads; ++i) {
+                    _queues.emplace_back(new queue());
+                }
+                for (size_t i = 1; i <= threads; ++i) {
+                    _threads.emplace_back([this, i] { work(i); });
+                }
+            }
+
+        public:
+            ~work_stealing_pool() {
+                {
+                    ::std::lock_guard<::std::mutex> guard(_idle_lock);
+                    _stopping = true;
+                }
+                _idle.notify_all();
+                for (auto& t : _threads) {
+                    t.join();
+                }
+            }
+
+            work_stealing_pool(const work_stealing_pool&) = delete;
+            work_stealing_pool& operator =(const work_stealing_pool&) = delete;
+
+            static work_stealing_pool& shared() {
+                static work_stealing_pool instance;
+                return instance;
+            }
+
+            // Including the calling thread
+            size_t concurrency() const {
+                return _queues.size();
+            }
+
+            // Calls body(i) for every i in [0, count) and returns when all
+            // have finished. The first exception thrown is rethrown here,
+            // and chunks that have not started by then are skipped.
+            void run(size_t count, const ::std::function<void(size_t)>& body) {
+                if (count == 0) {
+                    return;
+                }
+
+                job j(body, count);
+                {
+                    ::std::lock_guard<::std::mutex> guard(_idle_lock);
+                    _queued += count;
+                }
+                // Neighbouring chunks go to the same queue, so each thread
+                // starts on contiguous data
+                auto n = _queues.size();
+                for (size_t q = 0; q < n; ++q) {
+                    ::std::lock_guard<::std::mutex> guard(_queues[q]->lock);
+                    for (auto c = q * count / n; c < (q + 1) * count / n; ++c) {
+                        task t = { &j, c };
+                        _queues[q]->tasks.push_back(t);
+                    }
+                }
+                _idle.notify_all();
+
+                task t;
+                while (j.remaining.load() > 0 && take(0, t)) {
+                    execute(t);
+                }
+
+                ::std::unique_lock<::std::mutex> l(j.lock);
+                j.done.wait(l, [&] { return j.remaining.load() == 0; });
+                if (j.failure) {
+                    ::std::rethrow_exception(j.failure);
+                }
+            }
+        };
+
+        inline size_t chunk_size_for(size_t count, const parallel_options& options) {
+            if (options.chunk_size != 0) {
+                return options.chunk_size;
+            }
+            auto tasks = 4 * work_stealing_pool::shared().concurrency();
+            return (::std::max)(static_cast<size_t>(1), count / tasks);
+        }
+
+        // Results written from several threads. Each slot is constructed
+        // by the thread that computes it, so results need not be
+        // default-constructible.
+        template<typename T>
+        class result_slots {
+            typedef typename ::std::aligned_storage<sizeof(T), alignof(T)>::type slot;
+
+            ::std::unique_ptr<slot[]> _slots;
+            // Not vector<bool>, which cannot be written from several threads
+            ::std::vector<char> _constructed;
+
+        public:
+            explicit result_slots(size_t count) : _slots(new slot[count]), _constructed(count, 0) { }
+
+            ~result_slots() {
+                for (size_t i = 0; i < _constructed.size(); ++i) {
+                    if (_constructed[i]) {
+                        (*this)[i].~T();
+                    }
+                }
+            }
+
+            result_slots(const result_slots&) = delete;
+            result_slots& operator =(const result_slots&) = delete;
+
+            template<typename TValue>
+            void set(size_t i, TValue&& value) {
+                new (&_slots[i]) T(::std::forward<TValue>(value));
+                _constructed[i] = 1;
+            }
+
+            const T& operator [](size_t i) const {
+                return *reinterpret_cast<const T*>(&_slots[i]);
+            }
+        };
+
+        template<typename T>
+        ::std::vector<T> unbox_sequence(PyObject *seq) {
+            static_assert(!::std::is_base_of<_py_ptrbase, typename arg_converter<T>::type>::value,
+                "items are used without the GIL, so they must be native values");
+            return unbox<T>(seq);
+        }
+    }
+
+    // Calls kernel(begin, end) over [0, count) in chunks on the shared pool.
+    // The kernel must not use Python objects.
+    template<typename TKernel>
+    void parallel_for_range(size_t count, TKernel kernel, const parallel_options& options = parallel_options()) {
+        auto chunk = details::chunk_size_for(count, options);
+        ::std::function<void(size_t)> body = [&](size_t c) {
+            auto begin = c * chunk;
+            kernel(begin, (::std::min)(count, begin + chunk));
+        };
+        details::work_stealing_pool::shared().run((count + chunk - 1) / chunk, body);
+    }
+
+    // Unboxes each item of a list or tuple as T, then calls kernel(const T&)
+    // on every item with the GIL released. The caller must hold the GIL.
+    template<typename T, typename TSeq, typename TKernel>
+    void parallel_for(const TSeq& seq, TKernel kernel, const parallel_options& options = parallel_options()) {
+        auto values = details::unbox_sequence<T>(seq);
+        allow_threads release;
+        parallel_for_range(values.size(), [&](size_t begin, size_t end) {
+            for (auto i = begin; i < end; ++i) {
+                kernel(static_cast<const T&>(values[i]));
+            }
+        }, options);
+    }
+
+    // As parallel_for, collecting kernel's results into a new list.
+    template<typename T, typename TSeq, typename TKernel>
+    auto parallel_transform(const TSeq& seq, TKernel kernel, const parallel_options& options = parallel_options())
+        -> py_list<typename details::pyptr_type<typename ::std::decay<decltype(kernel(::std::declval<const T&>()))>::type>::type> {
+        typedef typename ::std::decay<decltype(kernel(::std::declval<const T&>()))>::type TResult;
+        typedef typename details::pyptr_type<TResult>::type TElement;
+
+        auto values = details::unbox_sequence<T>(seq);
+        details::result_slots<TResult> results(values.size());
+        {
+            allow_threads release;
+            parallel_for_range(values.size(), [&](size_t begin, size_t end) {
+                for (auto i = begin; i < end; ++i) {
+                    results.set(i, kernel(static_cast<const T&>(values[i])));
+                }
+            }, options);
+        }
+
+        // Slots not yet filled when boxing fails are left NULL, which the
+        // list's deallocation allows
+        py_list<TElement> result = steal(PyList_New(static_cast<Py_ssize_t>(values.size())));
+        for (size_t i = 0; i < values.size(); ++i) {
+            auto item = details::box_item<TResult, TElement>(results[i]);
+            PyList_SET_ITEM(static_cast<PyObject*>(result), static_cast<Py_ssize_t>(i), item);
+        }
+        return result;
+    }
+}
@@ -0,0 +1,307 @@
+#pragma once
+
+#include "py_ptr.h"
+#include "converters.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#ifdef pyptr_HAS_SPAN
+#include <span>
+#endif
+
+//
+// Typed views over objects that support the buffer protocol, such as bytes,
+// bytearray, array.array, memoryview and NumPy arrays. The buffer's format
+// is checked against T once, when the view is acquired, and the items are
+// then used in place.
+//
+//     py_buffer<const double> values(obj);
+//     for (auto v : values.span()) { ... }
+//
+
+namespace python {
+    namespace details {
+        // The kind of item a type can view: 'i' signed, 'u' unsigned, 'f'
+        // floating point, '?' bool, or 'x' for any single byte.
+        template<typename T>
+        struct buffer_item {
+            static const char kind =
+                ::std::is_same<T, bool>::value ? '?' :
+                ::std::is_same<T, char>::value ? 'x' :
+                ::std::is_floating_point<T>::value ? 'f' :
+                ::std::is_integral<T>::value ? (::std::is_signed<T>::value ? 'i' : 'u') :
+                0;
+        };
+
+        template<typename T> struct buffer_item<const T> : buffer_item<T> { };
+
+#ifdef pyptr_HAS_SPAN
+        template<> struct buffer_item<::std::byte> { static const char kind = 'x'; };
+#endif
+
+        // The format exported for items of type T
+        template<typename T> struct buffer_format;
+        template<typename T> struct buffer_format<const T> : buffer_format<T> { };
+
+#define PYPTR_BUFFER_FORMAT(T, FORMAT) \
+        template<> struct buffer_format<T> { static const char *value() { return FORMAT; } }
+
+        PYPTR_BUFFER_FORMAT(bool, "?");
+        PYPTR_BUFFER_FORMAT(char, "c");
+        PYPTR_BUFFER_FORMAT(signed char, "b");
+        PYPTR_BUFFER_FORMAT(unsigned char, "B");
+        PYPTR_BUFFER_FORMAT(short, "h");
+        PYPTR_BUFFER_FORMAT(unsigned short, "H");
+        PYPTR_BUFFER_FORMAT(int, "i");
+        PYPTR_BUFFER_FORMAT(unsigned int, "I");
+        PYPTR_BUFFER_FORMAT(long, "l");
+        PYPTR_BUFFER_FORMAT(unsigned long, "L");
+        PYPTR_BUFFER_FORMAT(long long, "q");
+        PYPTR_BUFFER_FORMAT(unsigned long long, "Q");
+        PYPTR_BUFFER_FORMAT(float, "f");
+        PYPTR_BUFFER_FORMAT(double, "d");
+#ifdef pyptr_HAS_SPAN
+        PYPTR_BUFFER_FORMAT(::std::byte, "B");
+#endif
+#undef PYPTR_BUFFER_FORMAT
+
+        template<typename TInner> struct buffer_export;
+
+        // Returns the kind of a struct-module format with a single item in
+        // native byte order, or zero for anything else.
+        inline char buffer_format_kind(const char *format) {
+            if (format == nullptr) {
+                return 'u';
+            }
+            switch (*format) {
+            case '@':
+            case '=':
+#ifdef WORDS_BIGENDIAN
+            case '>':
+            case '!':
+#else
+            case '<':
+#endif
+                ++format;
+                break;
+            }
+            if (format[0] == '\0' || format[1] != '\0') {
+                return 0;
+            }
+            switch (format[0]) {
+            case 'b': case 'h': case 'i': case 'l': case 'q': case 'n':
+                return 'i';
+            case 'B': case 'H': case 'I': case 'L': case 'Q': case 'N':
+                return 'u';
+            case 'e': case 'f': case 'd':
+                return 'f';
+            case '?':
+                return '?';
+            case 'c':
+                return 'c';
+            }
+            return 0;
+        }
+
+        // Sizes are compared separately, since the same letter may have a
+        // different size in standard and native modes.
+        inline bool buffer_matches(char kind, size_t size, const Py_buffer& view) {
+            if (view.itemsize != static_cast<Py_ssize_t>(size)) {
+                return false;
+            }
+            auto actual = buffer_format_kind(view.format);
+            return kind == 'x' ? actual != 0 : actual == kind;
+        }
+    }
+
+    // A base for classes that export their memory with
+    // class_factory::buffer. It counts the views that are alive, and members
+    // that reallocate the memory should call check_resizable() first.
+    class buffer_exports {
+        template<typename TInner> friend struct details::buffer_export;
+
+        ::std::atomic<Py_ssize_t> _exports;
+
+    public:
+        buffer_exports() : _exports(0) { }
+
+        // Copies are not exported
+        buffer_exports(const buffer_exports&) : _exports(0) { }
+        buffer_exports& operator =(const buffer_exports&) { return *this; }
+
+        bool exported() const {
+            return _exports.load() != 0;
+        }
+
+        void check_resizable() const {
+            if (exported()) {
+                PyErr_SetString(PyExc_BufferError, "Existing exports of data: object cannot be re-sized");
+                details::throw_pyerr();
+            }
+        }
+    };
+
+    // Holds an exported buffer for its lifetime. A non-const T requests a
+    // writable buffer.
+    template<typename T>
+    class py_buffer {
+        static_assert(details::buffer_item<T>::kind != 0, "py_buffer items must be arithmetic types");
+
+        Py_buffer _view;
+
+        static int flags() {
+            return ::std::is_const<T>::value ? PyBUF_RECORDS_RO : PyBUF_RECORDS;
+        }
+
+        // Exporters may point shape or strides into the Py_buffer itself,
+        // such as at itemsize for one dimension, so those move with it.
+        void repoint(Py_ssize_t *&field, const Py_buffer& from) {
+            auto begin = reinterpret_cast<uintptr_t>(&from);
+            auto p = reinterpret_cast<uintptr_t>(field);
+            if (p >= begin && p < begin + sizeof(Py_buffer)) {
+                field = reinterpret_cast<Py_ssize_t*>(reinterpret_cast<char*>(&_view) + (p - begin));
+            }
+        }
+
+    public:
+        explicit py_buffer(PyObject *obj) {
+            if (PyObject_GetBuffer(obj, &_view, flags()) != 0) {
+                details::throw_pyerr();
+            }
+            if (!details::buffer_matches(details::buffer_item<T>::kind, sizeof(T), _view)) {
+                PyErr_Format(PyExc_TypeError, "cannot view a buffer of format '%s' and item size %zd as the requested type",
+                    _view.format != nullptr ? _view.format : "B", _view.itemsize);
+                PyBuffer_Release(&_view);
+                details::throw_pyerr();
+            }
+        }
+
+        py_buffer(py_buffer&& other) : _view(other._view) {
+            repoint(_view.shape, other._view);
+            repoint(_view.strides, other._view);
+            repoint(_view.suboffsets, other._view);
+            other._view.obj = nullptr;
+        }
+
+        ~py_buffer() {
+            if (_view.obj != nullptr) {
+                PyBuffer_Release(&_view);
+            }
+        }
+
+        py_buffer(const py_buffer&) = delete;
+        py_buffer& operator =(const py_buffer&) = delete;
+
+        // Whether obj exports a buffer that can be viewed as T. The buffer
+        // is acquired and released to read its format.
+        static bool viewable(PyObject *obj) {
+            if (!PyObject_CheckBuffer(obj)) {
+                return false;
+            }
+            Py_buffer view;
+            if (PyObject_GetBuffer(obj, &view, flags()) != 0) {
+                PyErr_Clear();
+                return false;
+            }
+            auto result = details::buffer_matches(details::buffer_item<T>::kind, sizeof(T), view);
+            PyBuffer_Release(&view);
+            return result;
+        }
+
+        const Py_buffer& view() const {
+            return _view;
+        }
+
+        T *data() const {
+            return static_cast<T*>(_view.buf);
+        }
+
+        // The number of items in all dimensions
+        size_t size() const {
+            return static_cast<size_t>(_view.len / _view.itemsize);
+        }
+
+        size_t ndim() const {
+            return static_cast<size_t>(_view.ndim);
+        }
+
+        Py_ssize_t shape(size_t dim) const {
+            return _view.shape[dim];
+        }
+
+        // In bytes, and possibly negative
+        Py_ssize_t stride(size_t dim) const {
+            return _view.strides[dim];
+        }
+
+        bool readonly() const {
+            return _view.readonly != 0;
+        }
+
+        bool contiguous() const {
+            return PyBuffer_IsContiguous(&_view, 'C') != 0;
+        }
+
+        // Indexes by the strides, like mdspan. The number of indices must
+        // match ndim() and they are not bounds checked.
+        template<typename... TIndex>
+        T& operator()(TIndex... index) const {
+            assert(sizeof...(TIndex) == ndim());
+            const Py_ssize_t indices[] = { static_cast<Py_ssize_t>(index)..., 0 };
+            auto p = static_cast<char*>(_view.buf);
+            for (size_t i = 0; i < sizeof...(TIndex); ++i) {
+                p += indices[i] * _view.strides[i];
+            }
+            return *reinterpret_cast<T*>(p);
+        }
+
+#ifdef pyptr_HAS_SPAN
+        // Throws BufferError unless the buffer is C-contiguous
+        ::std::span<T> span() const {
+            if (!contiguous()) {
+                PyErr_SetString(PyExc_BufferError, "buffer is not C-contiguous");
+                details::throw_pyerr();
+            }
+            return { data(), size() };
+        }
+
+        operator ::std::span<T>() const {
+            return span();
+        }
+
+        ::std::span<const Py_ssize_t> shape() const {
+            return { _view.shape, ndim() };
+        }
+
+        ::std::span<const Py_ssize_t> strides() const {
+            return { _view.strides, ndim() };
+        }
+#endif
+    };
+
+#ifdef pyptr_HAS_SPAN
+    namespace details {
+        // Callbacks may take spans of items. The buffer is held until the
+        // callback returns. Whether an argument matches depends on its
+        // buffer's format, not just its type, so overloads taking spans are
+        // resolved on every call.
+        template<typename T>
+        struct arg_converter<::std::span<T>> {
+            typedef py_buffer<T> type;
+
+            static inline bool check(PyObject *arg) {
+                return py_buffer<T>::viewable(arg);
+            }
+
+            static inline py_buffer<T> convert(PyObject *arg) {
+                return py_buffer<T>(arg);
+            }
+        };
+
+        template<typename T> struct check_depends_on_value<::std::span<T>> : ::std::true_type { };
+    }
+#endif
+}
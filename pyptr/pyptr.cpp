@@ -1,59 +1,161 @@
-﻿//
-// This file is intended to test build and code-gen, but will not execute
-// correctly because it includes invalid Python operations.
-//
-
-#include "py_ptr.h"
-
-using namespace python;
-
-#include <iostream>
-
-int main() {
-    interpreter py_interpreter;
-
-    gil _g;
-    py_int x = 123;
-    py_str y = repr(x);
-    
-    auto tup = make_py_tuple(x, y);
-    auto lst = make_py_list<py_int>(1, 2, 3);
-
-    auto i0 = tup.get<0>();
-    auto i1 = tup.get<1>();
-    auto i2 = py_ptr(); // tup.get<2>();
-    i2 = i0;
-    i1 = L"hello";
-    i1 = "world";
-
-    {
-        allow_threads _at(_g);
-        i0 = i2.cast<py_int>();
-    }
-
-    setattr(tup, "attr", i1);
-    i0 = getattr<py_int>(tup, "attr");
-    i2 = getattr(tup, "attr");
-    delattr(tup, "attr");
-
-    py_callable<py_str> callable;
-    i2 = callable(tup);
-
-    auto res = call(callable, i0);
-    auto res2 = call_varargs(callable, make_py_tuple(i2, i0));
-    auto res3 = call(callable, arg("name", i0), i2);
-
-    for (auto i : tup) {
-        static_assert(std::is_same<decltype(i), py_ptr>::value, "expected py_ptr");
-    }
-    for (auto i : lst) {
-        static_assert(std::is_same<decltype(i), py_int>::value, "expected py_int");
-    }
-
-    auto lst2 = py_list<py_bool>(std::begin(tup), std::end(tup));
-    lst2.append(true);
-    lst2.append(false);
-    lst2.del(-1);
-    lst2.del(-1);
-    static_assert(std::is_convertible<decltype(lst2[0]), py_bool>::value, "expected bool");
+﻿//
+// This file is intended to test build and code-gen, but will not execute
+// correctly because it includes invalid Python operations.
+//
+
+#include "py_ptr.h"
+
+using namespace python;
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+static double scale(double value, long long factor, bool negate) {
+    return negate ? -value * factor : value * factor;
+}
+
+#ifdef pyptr_HAS_SPAN
+static double sum(std::span<const double> values) {
+    double total = 0;
+    for (auto v : values) {
+        total += v;
+    }
+    return total;
+}
+#endif
+
+static long long twice_int(long long value) {
+    return value * 2;
+}
+
+static double twice_float(double value) {
+    return value * 2;
+}
+
+struct counter {
+    long long value;
+
+    counter() : value(0) { }
+
+    long long increment() {
+        return ++value;
+    }
+};
+
+struct samples : buffer_exports {
+    std::vector<double> values;
+
+    std::vector<double>& data() {
+        return values;
+    }
+
+    void resize(long long count) {
+        check_resizable();
+        values.resize(static_cast<size_t>(count));
+    }
+};
+
+int main() {
+    interpreter py_interpreter;
+
+    PYPTR_GIL(_g, "main");
+    py_int x = 123;
+    py_str y = repr(x);
+    
+    auto tup = make_py_tuple(x, y);
+    auto lst = make_py_list<py_int>(1, 2, 3);
+
+    auto i0 = tup.get<0>();
+    auto i1 = tup.get<1>();
+    auto i2 = py_ptr(); // tup.get<2>();
+    i2 = i0;
+    i1 = L"hello";
+    i1 = "world";
+
+    {
+        allow_threads _at(_g);
+        i0 = i2.cast<py_int>();
+    }
+
+    setattr(tup, "attr", i1);
+    i0 = getattr<py_int>(tup, PYPTR_STR("attr"));
+    i2 = getattr(tup, "attr");
+    delattr(tup, "attr");
+
+    py_callable<py_str> callable;
+    i2 = callable(tup);
+
+    auto res = call(callable, i0);
+    auto res2 = call_varargs(callable, make_py_tuple(i2, i0));
+    auto res3 = call(callable, arg("name", i0), i2);
+
+    auto scale_callback = make_callback(&scale);
+    i2 = call(scale_callback, 1.5, 2, false);
+
+    auto scale_named = make_callback(&scale, { "value", "factor", "negate" });
+    i2 = call(scale_named, 1.5, arg("factor", 2), arg("negate", true));
+
+#ifdef pyptr_HAS_SPAN
+    auto sum_callback = make_callback(&sum);
+    i2 = call(sum_callback, i2);
+#endif
+
+    auto twice = overloads(&twice_int, &twice_float);
+    i2 = call(twice, 3);
+
+    class_factory<counter> counter_class("pyptr_test.counter", true);
+    counter_class["increment"] = &counter::increment;
+    auto c = counter_class.create_instance();
+    c->increment();
+
+    class_factory<samples> samples_class("pyptr_test.samples");
+    samples_class["resize"] = &samples::resize;
+    samples_class.buffer(&samples::data);
+    auto s = samples_class.create_instance();
+    py_buffer<double> s_view(s);
+
+    for (auto i : tup) {
+        static_assert(std::is_same<decltype(i), py_ptr>::value, "expected py_ptr");
+    }
+    for (auto i : lst) {
+        static_assert(std::is_same<decltype(i), py_int>::value, "expected py_int");
+    }
+    for (auto i : lst.borrowed_items()) {
+        static_assert(std::is_same<decltype(i), borrowed<py_int>>::value, "expected borrowed<py_int>");
+        i0 = i.own();
+    }
+    auto b1 = tup.get_borrowed<1>();
+    i1 = b1.own();
+    i1 = b1->cast<py_str>(unchecked);
+    auto b0 = borrowed<py_int>(tup.get_borrowed<0>(), checked);
+
+    auto doubled = parallel_transform<long>(lst, [](long v) { return v * 2; }, parallel_options(1));
+    parallel_for<long>(doubled, [](long v) { });
+
+    auto values = doubled.to_vector<long>();
+    auto items = doubled.to_vector();
+    auto lst3 = py_list<py_int>(values);
+    auto unboxed = unbox<double>(doubled);
+    auto reboxed = box(unboxed.data(), unboxed.size());
+
+    bytes_writer writer(16);
+    writer.write("header", 6);
+    auto body = writer.prepare(64);
+    std::memset(body, 0, 64);
+    writer.commit(64);
+    py_bytes message = writer.finish();
+    std::string copied = message;
+    auto ba = py_bytearray(message.data(), message.size());
+    ba.resize(8);
+
+    py_buffer<const double> buf(i2);
+    auto first = buf.ndim() == 1 ? buf(0) : 0.0;
+
+    auto lst2 = py_list<py_bool>(std::begin(tup), std::end(tup));
+    lst2.append(true);
+    lst2.append(false);
+    lst2.del(-1);
+    lst2.del(-1);
+    static_assert(std::is_convertible<decltype(lst2[0]), py_bool>::value, "expected bool");
 }
\ No newline at end of file
@@ -0,0 +1,221 @@
+#pragma once
+
+//
+// Reference count accounting. Define pyptr_REFCOUNT_TRACE to count the
+// Py_INCREF/Py_DECREF operations performed by the wrappers, and (after
+// refcount_trace::install_allocator_hook()) the allocations made through
+// the Python allocators, on each thread.
+//
+// refcount_trace::scope measures everything on the current thread between
+// its construction and a call to counted(). PYPTR_TRACE_ENTRY marks a pyptr
+// entry point; totals for each are available from snapshot().
+//
+// Without pyptr_REFCOUNT_TRACE the PYPTR_* macros are the plain Py_* ones.
+//
+
+#ifdef pyptr_REFCOUNT_TRACE
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+namespace python {
+    namespace refcount_trace {
+        struct counts {
+            uint64_t increfs;
+            uint64_t decrefs;
+            uint64_t allocs;
+            uint64_t frees;
+
+            counts operator -(const counts& other) const {
+                counts result = {
+                    increfs - other.increfs,
+                    decrefs - other.decrefs,
+                    allocs - other.allocs,
+                    frees - other.frees
+                };
+                return result;
+            }
+
+            counts& operator +=(const counts& other) {
+                increfs += other.increfs;
+                decrefs += other.decrefs;
+                allocs += other.allocs;
+                frees += other.frees;
+                return *this;
+            }
+        };
+
+        struct entry_totals {
+            uint64_t calls;
+            counts inclusive;
+        };
+
+        inline counts& thread_counts() {
+            static thread_local counts value = { 0, 0, 0, 0 };
+            return value;
+        }
+
+        inline void on_incref() { ++thread_counts().increfs; }
+        inline void on_decref() { ++thread_counts().decrefs; }
+        inline void on_xincref(const void *obj) { if (obj != nullptr) ++thread_counts().increfs; }
+        inline void on_xdecref(const void *obj) { if (obj != nullptr) ++thread_counts().decrefs; }
+
+        namespace details {
+            struct entry_table {
+                ::std::mutex lock;
+                ::std::map<::std::string, entry_totals> entries;
+
+                static entry_table& get() {
+                    static entry_table instance;
+                    return instance;
+                }
+            };
+        }
+
+        inline ::std::map<::std::string, entry_totals> snapshot() {
+            auto& table = details::entry_table::get();
+            ::std::lock_guard<::std::mutex> guard(table.lock);
+            return table.entries;
+        }
+
+        inline void reset() {
+            auto& table = details::entry_table::get();
+            ::std::lock_guard<::std::mutex> guard(table.lock);
+            table.entries.clear();
+        }
+
+        class scope {
+            counts _start;
+
+        public:
+            scope() : _start(thread_counts()) { }
+
+            counts counted() const {
+                return thread_counts() - _start;
+            }
+
+            // Throws std::logic_error if more operations than allowed have
+            // happened since the scope began.
+            void expect_at_most(uint64_t increfs, uint64_t decrefs,
+                uint64_t allocs = (::std::numeric_limits<uint64_t>::max)()) const {
+                auto c = counted();
+                if (c.increfs > increfs || c.decrefs > decrefs || c.allocs > allocs) {
+                    throw ::std::logic_error(
+                        "refcount budget exceeded: " +
+                        ::std::to_string(c.increfs) + " increfs (max " + ::std::to_string(increfs) + "), " +
+                        ::std::to_string(c.decrefs) + " decrefs (max " + ::std::to_string(decrefs) + "), " +
+                        ::std::to_string(c.allocs) + " allocations"
+                    );
+                }
+            }
+        };
+
+        // Adds the operations made while it is alive to the named entry.
+        // Entries nest, and totals are inclusive of nested entries.
+        class entry_scope {
+            const char *_name;
+            counts _start;
+
+        public:
+            explicit entry_scope(const char *name) : _name(name), _start(thread_counts()) { }
+
+            ~entry_scope() {
+                auto delta = thread_counts() - _start;
+                auto& table = details::entry_table::get();
+                ::std::lock_guard<::std::mutex> guard(table.lock);
+                auto& totals = table.entries[_name];
+                ++totals.calls;
+                totals.inclusive += delta;
+            }
+
+            entry_scope(const entry_scope&) = delete;
+            entry_scope& operator =(const entry_scope&) = delete;
+        };
+
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 5
+        namespace details {
+            struct allocator_hook {
+                PyMemAllocatorEx original[3];
+
+                static void *malloc(void *ctx, size_t size) {
+                    auto orig = reinterpret_cast<PyMemAllocatorEx*>(ctx);
+                    ++thread_counts().allocs;
+                    return orig->malloc(orig->ctx, size);
+                }
+
+                static void *calloc(void *ctx, size_t count, size_t size) {
+                    auto orig = reinterpret_cast<PyMemAllocatorEx*>(ctx);
+                    ++thread_counts().allocs;
+                    return orig->calloc(orig->ctx, count, size);
+                }
+
+                static void *realloc(void *ctx, void *ptr, size_t size) {
+                    auto orig = reinterpret_cast<PyMemAllocatorEx*>(ctx);
+                    if (ptr == nullptr) {
+                        ++thread_counts().allocs;
+                    }
+                    return orig->realloc(orig->ctx, ptr, size);
+                }
+
+                static void free(void *ctx, void *ptr) {
+                    auto orig = reinterpret_cast<PyMemAllocatorEx*>(ctx);
+                    if (ptr != nullptr) {
+                        ++thread_counts().frees;
+                    }
+                    orig->free(orig->ctx, ptr);
+                }
+
+                static allocator_hook& get() {
+                    static allocator_hook instance;
+                    return instance;
+                }
+            };
+        }
+
+        // Wraps the PyMem and PyObject allocators so allocations are counted.
+        // Call once, before any scope that checks allocations.
+        inline void install_allocator_hook() {
+            static bool installed = false;
+            if (installed) {
+                return;
+            }
+            installed = true;
+            auto& hook = details::allocator_hook::get();
+            PyMemAllocatorDomain domains[] = { PYMEM_DOMAIN_RAW, PYMEM_DOMAIN_MEM, PYMEM_DOMAIN_OBJ };
+            for (int i = 0; i < 3; ++i) {
+                PyMem_GetAllocator(domains[i], &hook.original[i]);
+                PyMemAllocatorEx wrapped = {
+                    &hook.original[i],
+                    details::allocator_hook::malloc,
+                    details::allocator_hook::calloc,
+                    details::allocator_hook::realloc,
+                    details::allocator_hook::free
+                };
+                PyMem_SetAllocator(domains[i], &wrapped);
+            }
+        }
+#endif
+    }
+}
+
+#define PYPTR_INCREF(o) (::python::refcount_trace::on_incref(), Py_INCREF(o))
+#define PYPTR_DECREF(o) (::python::refcount_trace::on_decref(), Py_DECREF(o))
+#define PYPTR_XINCREF(o) (::python::refcount_trace::on_xincref(o), Py_XINCREF(o))
+#define PYPTR_XDECREF(o) (::python::refcount_trace::on_xdecref(o), Py_XDECREF(o))
+#define PYPTR_CLEAR(o) do { ::python::refcount_trace::on_xdecref(o); Py_CLEAR(o); } while (0)
+#define PYPTR_TRACE_ENTRY(NAME) ::python::refcount_trace::entry_scope pyptr_trace_entry_(NAME)
+
+#else
+
+#define PYPTR_INCREF(o) Py_INCREF(o)
+#define PYPTR_DECREF(o) Py_DECREF(o)
+#define PYPTR_XINCREF(o) Py_XINCREF(o)
+#define PYPTR_XDECREF(o) Py_XDECREF(o)
+#define PYPTR_CLEAR(o) Py_CLEAR(o)
+#define PYPTR_TRACE_ENTRY(NAME)
+
+#endif
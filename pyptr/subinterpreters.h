@@ -0,0 +1,252 @@
+#pragma once
+
+#include "py_ptr.h"
+#include "initialization.h"
+#include "errors.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//
+// Sub-interpreters with their own GIL (Python 3.12 and later). Each worker
+// of an interpreter_pool runs its own interpreter, so tasks on different
+// workers execute Python in parallel. Extension modules used by the tasks
+// must support this; modules exported with
+// EXPORT_PYTHON_MODULE_PER_INTERPRETER do.
+//
+// Python objects belong to the interpreter that created them, so tasks take
+// and return native values only.
+//
+
+#if PY_MAJOR_VERSION == 3 && PY_MINOR_VERSION >= 12
+#define pyptr_SUBINTERPRETERS
+
+namespace python {
+    // An isolated interpreter with its own GIL, bound to the thread that
+    // created it. The creating thread must not hold the main GIL. While the
+    // object is alive, the thread runs in the new interpreter and holds its
+    // GIL, and gil scopes on it only adjust the nesting count.
+    class sub_interpreter {
+        PyGILState_STATE _main_state;
+        PyThreadState *_main;
+        PyThreadState *_tstate;
+        details::gil_thread_state _outer;
+
+    public:
+        sub_interpreter() : _outer(details::gil_tls()) {
+            _main_state = PyGILState_Ensure();
+            _main = PyThreadState_Get();
+
+            PyInterpreterConfig config;
+            ::std::memset(&config, 0, sizeof(config));
+            config.use_main_obmalloc = 0;
+            config.allow_fork = 0;
+            config.allow_exec = 0;
+            config.allow_threads = 1;
+            config.allow_daemon_threads = 0;
+            config.check_multi_interp_extensions = 1;
+            config.gil = PyInterpreterConfig_OWN_GIL;
+
+            _tstate = nullptr;
+            auto status = Py_NewInterpreterFromConfig(&_tstate, &config);
+            if (PyStatus_Exception(status)) {
+                PyGILState_Release(_main_state);
+                throw ::std::runtime_error(status.err_msg != nullptr ? status.err_msg : "unable to create sub-interpreter");
+            }
+
+            auto& t = details::gil_tls();
+            t.held = true;
+            t.depth = 1;
+        }
+
+        ~sub_interpreter() {
+            Py_EndInterpreter(_tstate);
+            details::gil_tls() = _outer;
+            PyEval_RestoreThread(_main);
+            PyGILState_Release(_main_state);
+        }
+
+        sub_interpreter(const sub_interpreter&) = delete;
+        sub_interpreter& operator =(const sub_interpreter&) = delete;
+
+        PyInterpreterState *state() const {
+            return _tstate->interp;
+        }
+    };
+
+    // A fixed set of worker threads, each pinned to its own sub_interpreter.
+    // Tasks are native callables run with the worker's GIL held.
+    class interpreter_pool {
+        struct worker {
+            ::std::thread thread;
+            ::std::mutex lock;
+            ::std::condition_variable wake;
+            ::std::deque<::std::function<void()>> tasks;
+            bool stopping;
+
+            worker() : stopping(false) { }
+        };
+
+        template<typename TFunction>
+        using task_result = decltype(::std::declval<TFunction&>()());
+
+        ::std::vector<::std::unique_ptr<worker>> _workers;
+        ::std::atomic<size_t> _next;
+
+        static void run(worker& w, ::std::promise<void>& started) {
+            ::std::unique_ptr<sub_interpreter> interp;
+            try {
+                interp.reset(new sub_interpreter());
+            } catch (...) {
+                started.set_exception(::std::current_exception());
+                return;
+            }
+            started.set_value();
+
+            ::std::deque<::std::function<void()>> batch;
+            for (;;) {
+                {
+                    // The lock is released before the GIL is reacquired
+                    allow_threads idle;
+                    ::std::unique_lock<::std::mutex> l(w.lock);
+                    w.wake.wait(l, [&] { return !w.tasks.empty() || w.stopping; });
+                    if (w.tasks.empty()) {
+                        break;
+                    }
+                    batch.swap(w.tasks);
+                }
+                for (auto& task : batch) {
+                    task();
+                }
+                batch.clear();
+            }
+        }
+
+        void stop() {
+            for (auto& w : _workers) {
+                ::std::lock_guard<::std::mutex> guard(w->lock);
+                w->stopping = true;
+                w->wake.notify_one();
+            }
+
+            // Workers need the main GIL to finish, so let it go while joining
+            ::std::unique_ptr<allow_threads> release;
+            if (gil::held()) {
+                release.reset(new allow_threads());
+            }
+            for (auto& w : _workers) {
+                if (w->thread.joinable()) {
+                    w->thread.join();
+                }
+            }
+        }
+
+        void post(size_t index, ::std::function<void()> task) {
+            auto& w = *_workers[index % _workers.size()];
+            ::std::lock_guard<::std::mutex> guard(w.lock);
+            w.tasks.push_back(::std::move(task));
+            w.wake.notify_one();
+        }
+
+        template<typename TFunction>
+        static ::std::shared_ptr<::std::packaged_task<task_result<TFunction>()>> make_task(TFunction fn) {
+            typedef task_result<TFunction> TResult;
+            static_assert(!::std::is_base_of<details::_py_ptrbase, TResult>::value,
+                "Python objects cannot leave the interpreter that created them");
+            return ::std::make_shared<::std::packaged_task<TResult()>>([fn]() -> TResult {
+                try {
+                    return fn();
+                } catch (const error& exc) {
+                    // The exception objects belong to this interpreter
+                    throw ::std::runtime_error(exc.what());
+                }
+            });
+        }
+
+    public:
+        // Starts count workers and waits until each has created its
+        // interpreter. Throws if any of them could not.
+        explicit interpreter_pool(size_t count) : _next(0) {
+            if (count == 0) {
+                throw ::std::invalid_argument("interpreter_pool needs at least one worker");
+            }
+
+            ::std::unique_ptr<allow_threads> release;
+            if (gil::held()) {
+                release.reset(new allow_threads());
+            }
+
+            ::std::vector<::std::promise<void>> started(count);
+            for (size_t i = 0; i < count; ++i) {
+                _workers.emplace_back(new worker());
+                auto w = _workers.back().get();
+                auto s = &started[i];
+                w->thread = ::std::thread([w, s] { run(*w, *s); });
+            }
+
+            ::std::exception_ptr failure;
+            for (auto& s : started) {
+                try {
+                    s.get_future().get();
+                } catch (...) {
+                    failure = ::std::current_exception();
+                }
+            }
+            release.reset();
+            if (failure) {
+                stop();
+                ::std::rethrow_exception(failure);
+            }
+        }
+
+        ~interpreter_pool() {
+            stop();
+        }
+
+        interpreter_pool(const interpreter_pool&) = delete;
+        interpreter_pool& operator =(const interpreter_pool&) = delete;
+
+        size_t size() const {
+            return _workers.size();
+        }
+
+        // Runs fn on the next worker in turn.
+        template<typename TFunction>
+        auto submit(TFunction fn) -> ::std::future<task_result<TFunction>> {
+            return submit_to(_next++, fn);
+        }
+
+        // Runs fn on a particular worker, for tasks that rely on state left
+        // in that worker's interpreter.
+        template<typename TFunction>
+        auto submit_to(size_t index, TFunction fn) -> ::std::future<task_result<TFunction>> {
+            auto task = make_task(fn);
+            auto result = task->get_future();
+            post(index, [task] { (*task)(); });
+            return result;
+        }
+
+        // Runs fn once on every worker, such as to import modules.
+        template<typename TFunction>
+        auto broadcast(TFunction fn) -> ::std::vector<::std::future<task_result<TFunction>>> {
+            ::std::vector<::std::future<task_result<TFunction>>> results;
+            for (size_t i = 0; i < _workers.size(); ++i) {
+                results.push_back(submit_to(i, fn));
+            }
+            return results;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,460 @@
+#pragma once
+
+#include "py_ptr.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+//
+// Boundary-crossing telemetry. Define pyptr_TELEMETRY to record call
+// counts, latency histograms and exception counts for every py_callback
+// (Python calling C++) and every python::call or py_callable call (C++
+// calling Python). Without it the hooks compile to nothing.
+//
+// Outbound calls are attributed to the innermost PYPTR_CALL_SITE on the
+// calling thread, or to "python::call" when there is none.
+//
+// Define pyptr_GIL_PROFILE to record how long gil waits to acquire the GIL
+// and how long it is held before being released or handed back by
+// allow_threads. Scopes declared with PYPTR_GIL are reported as
+// "<name> gil.wait" and "<name> gil.hold"; other gil objects as
+// "python::gil".
+//
+
+namespace python {
+    namespace telemetry {
+        typedef ::std::chrono::steady_clock clock;
+
+        // Log-linear histogram layout over nanoseconds. Values below
+        // 2^sub_bits get a bucket each; above that every power of two is
+        // split into 2^sub_bits buckets, so a bucket is never wider than
+        // 1/8th of its lower bound.
+        struct histogram_layout {
+            static const unsigned sub_bits = 3;
+            static const uint64_t sub_count = 1 << sub_bits;
+            static const unsigned max_bits = 40;
+            static const size_t bucket_count = (max_bits - sub_bits + 1) * sub_count;
+
+            static inline unsigned highest_bit(uint64_t value) {
+#if defined(_MSC_VER) && defined(_M_X64)
+                unsigned long index;
+                _BitScanReverse64(&index, value);
+                return static_cast<unsigned>(index);
+#elif defined(__GNUC__)
+                return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#else
+                unsigned index = 0;
+                while (value >>= 1) {
+                    ++index;
+                }
+                return index;
+#endif
+            }
+
+            static inline size_t bucket_of(uint64_t value) {
+                if (value < sub_count) {
+                    return static_cast<size_t>(value);
+                }
+                auto msb = highest_bit(value);
+                if (msb >= max_bits) {
+                    return bucket_count - 1;
+                }
+                auto shift = msb - sub_bits;
+                return static_cast<size_t>((shift + 1) * sub_count + ((value >> shift) & (sub_count - 1)));
+            }
+
+            static inline uint64_t lower_bound(size_t bucket) {
+                if (bucket < sub_count) {
+                    return bucket;
+                }
+                auto shift = bucket / sub_count - 1;
+                return (sub_count + bucket % sub_count) << shift;
+            }
+
+            static inline uint64_t upper_bound(size_t bucket) {
+                return bucket + 1 < bucket_count ? lower_bound(bucket + 1) - 1 : lower_bound(bucket);
+            }
+        };
+
+        struct snapshot {
+            ::std::string name;
+            uint64_t calls;
+            uint64_t exceptions;
+            uint64_t total_ns;
+            ::std::vector<uint64_t> buckets;
+
+            // Upper bound of the bucket holding the given fraction (0..1)
+            // of recorded calls.
+            uint64_t percentile(double fraction) const {
+                if (calls == 0) {
+                    return 0;
+                }
+                auto target = static_cast<uint64_t>(fraction * static_cast<double>(calls));
+                if (target >= calls) {
+                    target = calls - 1;
+                }
+                uint64_t seen = 0;
+                for (size_t i = 0; i < buckets.size(); ++i) {
+                    seen += buckets[i];
+                    if (seen > target) {
+                        return histogram_layout::upper_bound(i);
+                    }
+                }
+                return histogram_layout::upper_bound(buckets.size() - 1);
+            }
+
+            uint64_t mean_ns() const {
+                return calls ? total_ns / calls : 0;
+            }
+
+            void merge(const snapshot& other) {
+                calls += other.calls;
+                exceptions += other.exceptions;
+                total_ns += other.total_ns;
+                for (size_t i = 0; i < buckets.size() && i < other.buckets.size(); ++i) {
+                    buckets[i] += other.buckets[i];
+                }
+            }
+        };
+
+        class site;
+
+        namespace details {
+            static const size_t shard_count = 8;
+            static const size_t cache_line = 64;
+
+            // Sites live inside heap objects such as callback capsules,
+            // which plain new does not over-align, so the shards are
+            // allocated separately on cache line boundaries.
+            inline void *allocate_aligned(size_t size) {
+#if defined(_MSC_VER)
+                auto p = _aligned_malloc(size, cache_line);
+#else
+                void *p = nullptr;
+                if (posix_memalign(&p, cache_line, size) != 0) {
+                    p = nullptr;
+                }
+#endif
+                if (p == nullptr) {
+                    throw ::std::bad_alloc();
+                }
+                return p;
+            }
+
+            inline void free_aligned(void *p) {
+#if defined(_MSC_VER)
+                _aligned_free(p);
+#else
+                ::std::free(p);
+#endif
+            }
+
+            // Each thread writes to one shard of every site, chosen once per
+            // thread, so concurrent recorders rarely share a cache line.
+            inline size_t thread_shard() {
+                static ::std::atomic<size_t> next(0);
+                static thread_local size_t index = next++ % shard_count;
+                return index;
+            }
+
+            struct registry {
+                ::std::mutex lock;
+                ::std::vector<site*> sites;
+
+                static registry& get() {
+                    static registry instance;
+                    return instance;
+                }
+            };
+        }
+
+        class site {
+            struct shard {
+                ::std::atomic<uint64_t> calls;
+                ::std::atomic<uint64_t> exceptions;
+                ::std::atomic<uint64_t> total_ns;
+                ::std::atomic<uint64_t> buckets[histogram_layout::bucket_count];
+            };
+
+            // Shards start on their own cache line
+            static const size_t shard_stride = (sizeof(shard) + details::cache_line - 1) / details::cache_line * details::cache_line;
+
+            ::std::string _name;
+            // Allocated by the first record, so sites that are never used
+            // cost no more than a pointer.
+            ::std::atomic<char*> _shards;
+
+            static shard& shard_at(char *shards, size_t index) {
+                return *reinterpret_cast<shard*>(shards + index * shard_stride);
+            }
+
+            static void clear(shard& s) {
+                s.calls.store(0, ::std::memory_order_relaxed);
+                s.exceptions.store(0, ::std::memory_order_relaxed);
+                s.total_ns.store(0, ::std::memory_order_relaxed);
+                for (auto& b : s.buckets) {
+                    b.store(0, ::std::memory_order_relaxed);
+                }
+            }
+
+            char *shards() {
+                auto shards = _shards.load(::std::memory_order_acquire);
+                if (shards != nullptr) {
+                    return shards;
+                }
+                auto created = static_cast<char*>(details::allocate_aligned(shard_stride * details::shard_count));
+                for (size_t i = 0; i < details::shard_count; ++i) {
+                    clear(*new (created + i * shard_stride) shard);
+                }
+                if (!_shards.compare_exchange_strong(shards, created, ::std::memory_order_acq_rel, ::std::memory_order_acquire)) {
+                    // Another thread recorded first
+                    details::free_aligned(created);
+                    return shards;
+                }
+                return created;
+            }
+
+        public:
+            explicit site(::std::string name) : _name(::std::move(name)), _shards(nullptr) {
+                auto& reg = details::registry::get();
+                ::std::lock_guard<::std::mutex> guard(reg.lock);
+                reg.sites.push_back(this);
+            }
+
+            ~site() {
+                {
+                    auto& reg = details::registry::get();
+                    ::std::lock_guard<::std::mutex> guard(reg.lock);
+                    reg.sites.erase(::std::remove(reg.sites.begin(), reg.sites.end(), this), reg.sites.end());
+                }
+                auto shards = _shards.load(::std::memory_order_acquire);
+                if (shards != nullptr) {
+                    details::free_aligned(shards);
+                }
+            }
+
+            site(const site&) = delete;
+            site& operator =(const site&) = delete;
+
+            void rename(::std::string name) {
+                ::std::lock_guard<::std::mutex> guard(details::registry::get().lock);
+                _name = ::std::move(name);
+            }
+
+            void record(uint64_t elapsed_ns, bool failed) {
+                auto& s = shard_at(shards(), details::thread_shard());
+                s.calls.fetch_add(1, ::std::memory_order_relaxed);
+                if (failed) {
+                    s.exceptions.fetch_add(1, ::std::memory_order_relaxed);
+                }
+                s.total_ns.fetch_add(elapsed_ns, ::std::memory_order_relaxed);
+                s.buckets[histogram_layout::bucket_of(elapsed_ns)].fetch_add(1, ::std::memory_order_relaxed);
+            }
+
+            void reset() {
+                auto shards = _shards.load(::std::memory_order_acquire);
+                if (shards == nullptr) {
+                    return;
+                }
+                for (size_t i = 0; i < details::shard_count; ++i) {
+                    clear(shard_at(shards, i));
+                }
+            }
+
+            // Caller holds the registry lock.
+            snapshot take() const {
+                snapshot result;
+                result.name = _name;
+                result.calls = result.exceptions = result.total_ns = 0;
+                result.buckets.assign(histogram_layout::bucket_count, 0);
+                auto shards = _shards.load(::std::memory_order_acquire);
+                if (shards == nullptr) {
+                    return result;
+                }
+                for (size_t i = 0; i < details::shard_count; ++i) {
+                    auto& s = shard_at(shards, i);
+                    result.calls += s.calls.load(::std::memory_order_relaxed);
+                    result.exceptions += s.exceptions.load(::std::memory_order_relaxed);
+                    result.total_ns += s.total_ns.load(::std::memory_order_relaxed);
+                    for (size_t b = 0; b < histogram_layout::bucket_count; ++b) {
+                        result.buckets[b] += s.buckets[b].load(::std::memory_order_relaxed);
+                    }
+                }
+                return result;
+            }
+        };
+
+        inline ::std::vector<snapshot> snapshot_all() {
+            auto& reg = details::registry::get();
+            ::std::lock_guard<::std::mutex> guard(reg.lock);
+            ::std::vector<snapshot> result;
+            result.reserve(reg.sites.size());
+            for (auto s : reg.sites) {
+                result.push_back(s->take());
+            }
+            return result;
+        }
+
+        inline void reset_all() {
+            auto& reg = details::registry::get();
+            ::std::lock_guard<::std::mutex> guard(reg.lock);
+            for (auto s : reg.sites) {
+                s->reset();
+            }
+        }
+
+        // Times one boundary crossing. A call that never reports its result
+        // (because a C++ exception unwound through it) counts as failed.
+        class scope {
+            site& _site;
+            clock::time_point _start;
+            bool _failed;
+
+        public:
+            explicit scope(site& s) : _site(s), _start(clock::now()), _failed(true) { }
+
+            ~scope() {
+                auto elapsed = ::std::chrono::duration_cast<::std::chrono::nanoseconds>(clock::now() - _start);
+                _site.record(static_cast<uint64_t>(elapsed.count()), _failed);
+            }
+
+            PyObject *check(PyObject *result) {
+                _failed = result == nullptr;
+                return result;
+            }
+
+            scope(const scope&) = delete;
+            scope& operator =(const scope&) = delete;
+        };
+
+        // Attributes outbound calls made on this thread to a site until the
+        // end of the enclosing C++ scope.
+        class call_site {
+            site *_previous;
+
+            static site *&current_ptr() {
+                static thread_local site *current = nullptr;
+                return current;
+            }
+
+        public:
+            explicit call_site(site& s) : _previous(current_ptr()) {
+                current_ptr() = &s;
+            }
+
+            ~call_site() {
+                current_ptr() = _previous;
+            }
+
+            call_site(const call_site&) = delete;
+            call_site& operator =(const call_site&) = delete;
+
+            static site& current() {
+                auto s = current_ptr();
+                if (s == nullptr) {
+                    static site untagged("python::call");
+                    return untagged;
+                }
+                return *s;
+            }
+        };
+
+        // The wait and hold histograms for one gil call site.
+        struct gil_site {
+            site wait;
+            site hold;
+
+            explicit gil_site(const ::std::string& name)
+                : wait(name + " gil.wait"), hold(name + " gil.hold") { }
+
+            static gil_site& untagged() {
+                static gil_site value("python::gil");
+                return value;
+            }
+        };
+
+        namespace details {
+            inline uint64_t elapsed_ns(clock::time_point start, clock::time_point end) {
+                return static_cast<uint64_t>(::std::chrono::duration_cast<::std::chrono::nanoseconds>(end - start).count());
+            }
+
+            // The site whose gil acquired the GIL on this thread, and when.
+            struct gil_hold {
+                gil_site *site;
+                clock::time_point start;
+            };
+
+            inline gil_hold& current_gil_hold() {
+                static thread_local gil_hold value = { nullptr, clock::time_point() };
+                return value;
+            }
+
+            inline void gil_acquired(gil_site& s, clock::time_point wait_start) {
+                auto now = clock::now();
+                s.wait.record(elapsed_ns(wait_start, now), false);
+                auto& h = current_gil_hold();
+                h.site = &s;
+                h.start = now;
+            }
+
+            // Records the hold time so far and returns the site, so it can
+            // be passed back to gil_acquired when the GIL is reacquired.
+            inline gil_site *gil_released() {
+                auto& h = current_gil_hold();
+                auto s = h.site;
+                if (s != nullptr) {
+                    s->hold.record(elapsed_ns(h.start, clock::now()), false);
+                    h.site = nullptr;
+                }
+                return s;
+            }
+        }
+
+        // Wraps a C API call that returns a new reference (or nullptr on
+        // error) so it is recorded against the current outbound call site.
+        template<typename TCall>
+        inline PyObject *outbound(TCall call) {
+            PYPTR_ASSERT_GIL();
+#ifdef pyptr_TELEMETRY
+            scope s(call_site::current());
+            return s.check(call());
+#else
+            return call();
+#endif
+        }
+    }
+}
+
+#define pyptr_STRINGIZE_(X) #X
+#define pyptr_STRINGIZE(X) pyptr_STRINGIZE_(X)
+
+#ifdef pyptr_GIL_PROFILE
+#define PYPTR_GIL(VAR, NAME) \
+    static ::python::telemetry::gil_site VAR##_gil_site_(NAME); \
+    ::python::gil VAR(VAR##_gil_site_)
+#else
+#define PYPTR_GIL(VAR, NAME) ::python::gil VAR
+#endif
+#define PYPTR_GIL_HERE(VAR) PYPTR_GIL(VAR, __FILE__ ":" pyptr_STRINGIZE(__LINE__))
+
+#ifdef pyptr_TELEMETRY
+#define PYPTR_CALL_SITE(NAME) \
+    static ::python::telemetry::site pyptr_call_site_(NAME); \
+    ::python::telemetry::call_site pyptr_call_site_scope_(pyptr_call_site_)
+#else
+#define PYPTR_CALL_SITE(NAME)
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "py_ptr.h"
+#include "telemetry.h"
+#include "dict.h"
+#include "module.h"
+
+#include <map>
+#include <string>
+
+namespace python {
+    namespace telemetry {
+        // Exposes the recorded telemetry to Python as a module with
+        // snapshot() and reset(). snapshot() returns a dict mapping each site
+        // name to a dict of counters and latency percentiles in nanoseconds.
+        class module : public module_base {
+            static py_dict<py_str, py_ptr> snapshot() {
+                // Sites sharing a name are reported together.
+                ::std::map<::std::string, telemetry::snapshot> merged;
+                for (auto& s : snapshot_all()) {
+                    auto existing = merged.find(s.name);
+                    if (existing == merged.end()) {
+                        merged.emplace(s.name, s);
+                    } else {
+                        existing->second.merge(s);
+                    }
+                }
+
+                auto result = py_dict<py_str, py_ptr>::empty();
+                for (auto& item : merged) {
+                    auto& s = item.second;
+                    auto entry = py_dict<py_str, py_ptr>::empty();
+                    entry["calls"] = py_int(s.calls);
+                    entry["exceptions"] = py_int(s.exceptions);
+                    entry["total_ns"] = py_int(s.total_ns);
+                    entry["mean_ns"] = py_int(s.mean_ns());
+                    entry["p50_ns"] = py_int(s.percentile(0.5));
+                    entry["p90_ns"] = py_int(s.percentile(0.9));
+                    entry["p99_ns"] = py_int(s.percentile(0.99));
+                    entry["p999_ns"] = py_int(s.percentile(0.999));
+                    result[py_str(s.name.c_str())] = entry;
+                }
+                return result;
+            }
+
+            static void reset() {
+                reset_all();
+            }
+
+        public:
+            module(const char *name = "pyptr_telemetry") : module_base(name) {
+                (*this)["snapshot"] = snapshot;
+                (*this)["reset"] = reset;
+            }
+        };
+    }
+}
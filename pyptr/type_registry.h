@@ -0,0 +1,161 @@
+#pragma once
+
+#include "py_ptr.h"
+#include "interpreter_state.h"
+
+#include <mutex>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+namespace python {
+    namespace details {
+        // Maps the Python types created by class_factory to the C++ types
+        // they wrap, so py_object<T> can be checked by looking up Py_TYPE.
+        // There is one registry per interpreter, kept with the other pyptr
+        // statics in its interpreter_state.
+        class type_registry {
+        public:
+            struct entry {
+                const ::std::type_info *type;
+                bool inline_storage;
+
+                inline bool is(const ::std::type_info& other) const {
+                    return type == &other || *type == other;
+                }
+            };
+
+        private:
+            // Registered types. Every key is referenced so its address
+            // cannot be reused by an unrelated type.
+            ::std::unordered_map<PyTypeObject*, entry> _types;
+
+            // The result of looking up any other type: the registered base
+            // it derives from, or nullptr. The type and its MRO tuple are
+            // referenced, so neither address can be reused while the entry
+            // exists, and the result holds while the type has the same MRO.
+            // The table is emptied when it fills, so dynamically created
+            // classes are not kept alive indefinitely.
+            struct lookup_result {
+                PyObject *mro;
+                const entry *base;
+            };
+            ::std::unordered_map<PyTypeObject*, lookup_result> _lookups;
+            static const size_t max_lookups = 256;
+
+            free_threaded_mutex _lock;
+
+            // Freeing a type may run Python code, so references taken out of
+            // the tables are released after unlocking
+            typedef ::std::vector<PyObject*> released;
+
+            void take_lookups(released& out) {
+                for (auto& l : _lookups) {
+                    out.push_back(reinterpret_cast<PyObject*>(l.first));
+                    out.push_back(l.second.mro);
+                }
+                _lookups.clear();
+            }
+
+            static void release(released& objects) {
+                for (auto obj : objects) {
+                    PYPTR_DECREF(obj);
+                }
+            }
+
+            friend class interpreter_state;
+
+            type_registry() { }
+
+        public:
+            ~type_registry() {
+                released objects;
+                take_lookups(objects);
+                release(objects);
+                for (auto& t : _types) {
+                    PYPTR_DECREF(t.first);
+                }
+            }
+
+            type_registry(const type_registry&) = delete;
+            type_registry& operator =(const type_registry&) = delete;
+
+            // The registry for the calling thread's interpreter, or nullptr
+            // if no types have been registered there.
+            static type_registry *current() {
+                auto state = interpreter_state::current();
+                return state != nullptr ? state->find_native<type_registry>() : nullptr;
+            }
+
+            static type_registry& get_or_create() {
+                return interpreter_state::get().native<type_registry>();
+            }
+
+            static const entry *lookup(PyObject *obj) {
+                auto registry = current();
+                return registry != nullptr ? registry->find(Py_TYPE(obj)) : nullptr;
+            }
+
+            void add(PyTypeObject *type, const ::std::type_info& info, bool inlineStorage) {
+                entry e = { &info, inlineStorage };
+                released objects;
+                {
+                    ::std::lock_guard<free_threaded_mutex> guard(_lock);
+                    auto result = _types.emplace(type, e);
+                    if (result.second) {
+                        PYPTR_INCREF(type);
+                    } else {
+                        result.first->second = e;
+                    }
+                    take_lookups(objects);
+                }
+                release(objects);
+            }
+
+            const entry *find(PyTypeObject *type) {
+                released objects;
+                const entry *result = nullptr;
+                {
+                    ::std::lock_guard<free_threaded_mutex> guard(_lock);
+                    auto it = _types.find(type);
+                    if (it != _types.end()) {
+                        return &it->second;
+                    }
+
+                    auto mro = type->tp_mro;
+                    if (mro == nullptr) {
+                        return nullptr;
+                    }
+                    auto cached = _lookups.find(type);
+                    if (cached != _lookups.end() && cached->second.mro == mro) {
+                        return cached->second.base;
+                    }
+
+                    for (Py_ssize_t i = 1; i < PyTuple_GET_SIZE(mro); ++i) {
+                        auto base = _types.find(reinterpret_cast<PyTypeObject*>(PyTuple_GET_ITEM(mro, i)));
+                        if (base != _types.end()) {
+                            result = &base->second;
+                            break;
+                        }
+                    }
+
+                    PYPTR_INCREF(mro);
+                    if (cached != _lookups.end()) {
+                        objects.push_back(cached->second.mro);
+                        cached->second.mro = mro;
+                        cached->second.base = result;
+                    } else {
+                        if (_lookups.size() >= max_lookups) {
+                            take_lookups(objects);
+                        }
+                        PYPTR_INCREF(type);
+                        lookup_result r = { mro, result };
+                        _lookups.emplace(type, r);
+                    }
+                }
+                release(objects);
+                return result;
+            }
+        };
+    }
+}
@@ -0,0 +1,54 @@
+﻿//
+// Reference count budgets for the traced entry points. Built with
+// pyptr_REFCOUNT_TRACE and run after every build; a budget that is exceeded
+// fails the build.
+//
+
+#include "py_ptr.h"
+
+using namespace python;
+
+#include <iostream>
+#include <stdexcept>
+
+static void check_refcounts() {
+    py_int x = 123;
+    py_str y = repr(x);
+
+    {
+        refcount_trace::scope s;
+        py_int copy(x);
+        s.expect_at_most(1, 0);
+    }
+    {
+        refcount_trace::scope s;
+        auto obj = details::detach(x);
+        s.expect_at_most(2, 1);
+        PYPTR_DECREF(obj);
+    }
+    {
+        auto d = py_dict<py_str, py_int>::empty();
+        refcount_trace::scope s;
+        d[y] = x;
+        s.expect_at_most(3, 3);
+    }
+    {
+        refcount_trace::scope s;
+        auto tup = make_py_tuple(x, y);
+        s.expect_at_most(6, 4);
+    }
+}
+
+int main() {
+    interpreter py_interpreter;
+
+    PYPTR_GIL(_g, "refcount_test");
+    try {
+        check_refcounts();
+    } catch (const std::exception& exc) {
+        std::cerr << "refcount_test: " << exc.what() << std::endl;
+        return 1;
+    }
+    std::cout << "refcount_test: all budgets met" << std::endl;
+    return 0;
+}